@@ -10,6 +10,7 @@ LOCAL_SRC_FILES := \
 entityx/Entity.cc  \
 entityx/Event.cc  \
 entityx/System.cc \
+entityx/help/Arena.cc \
 entityx/help/Pool.cc \
 entityx/help/Timer.cc \
 
@@ -1,10 +1,13 @@
 #define CATCH_CONFIG_MAIN
 
 #include <iostream>
+#include <random>
+#include <unordered_set>
 #include <vector>
 #include "entityx/3rdparty/catch.hpp"
 #include "entityx/help/Timer.h"
 #include "entityx/Entity.h"
+#include "entityx/deps/Dependencies.h"
 
 using namespace std;
 using namespace entityx;
@@ -29,6 +32,7 @@ struct Listener : public Receiver<Listener> {
   int destroyed = 0;
 };
 
+// NOTE: Position and Direction are empty, so they are stored as tags.
 struct Position : public Component<Position> {
 };
 
@@ -37,6 +41,97 @@ struct Direction : public Component<Direction> {
 };
 
 
+struct Cell : public Component<Cell> {
+  explicit Cell(uint32_t index = 0) : index(index) {}
+
+  uint32_t index;
+};
+
+
+struct CellTracker : public Receiver<CellTracker> {
+  void receive(const ComponentAddedEvent<Cell> &event) { added.insert(event.entity.id().id()); }
+
+  std::unordered_set<uint64_t> added;
+};
+
+struct Transform {
+  float x = 0.0f;
+};
+
+
+struct Velocity {
+  explicit Velocity(float x = 0.0f) : x(x) {}
+
+  float x;
+};
+
+
+// As Transform and Velocity, but packed so that they can be owned by a group.
+struct PackedTransform : Transform {};
+
+struct PackedVelocity : Velocity {
+  using Velocity::Velocity;
+};
+
+namespace entityx {
+template <>
+struct PoolTraits<PackedTransform> {
+  typedef PackedPool<PackedTransform> PoolType;
+};
+
+template <>
+struct PoolTraits<PackedVelocity> {
+  typedef PackedPool<PackedVelocity> PoolType;
+};
+}  // namespace entityx
+
+
+struct Replicated {
+  uint32_t value = 0;
+};
+
+namespace entityx {
+template <>
+struct TrackChanges<Replicated> : std::true_type {};
+}  // namespace entityx
+
+
+struct IsVisible {};
+
+namespace entityx {
+template <>
+struct PoolTraits<IsVisible> {
+  typedef FlagPool PoolType;
+};
+}  // namespace entityx
+
+
+// Components of various sizes, stored either with the default 8192 element
+// chunks or with chunks sized to 64KB.
+template <std::size_t Bytes, bool Tuned>
+struct Sized : public Component<Sized<Bytes, Tuned>> {
+  char data[Bytes];
+};
+
+namespace entityx {
+template <std::size_t Bytes>
+struct PoolTraits<Sized<Bytes, true>> {
+  typedef Pool<Sized<Bytes, true>, ChunkSizeFor<Sized<Bytes, true>, 65536>::value> PoolType;
+};
+}  // namespace entityx
+
+// Pool memory used by C when assigned to entities [0, count) matching has_component.
+template <typename C, typename Predicate>
+std::size_t pool_bytes(std::size_t count, Predicate has_component) {
+  typename PoolTraits<C>::PoolType pool;
+  pool.resize(count);
+  for (std::size_t i = 0; i < count; i++) {
+    if (has_component(i)) pool.allocate(i);
+  }
+  return pool.allocated_chunks() * (pool.capacity() / pool.chunks()) * sizeof(C);
+}
+
+
 struct BenchmarkFixture {
   BenchmarkFixture() : em(ev) {}
 
@@ -144,3 +239,582 @@ TEST_CASE_METHOD(BenchmarkFixture, "TestEntityIterationUnpackTwo") {
     (void)e;
   }
 }
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestEntityIterationRandomAccessBeforeAndAfterSort") {
+  int count = 10000000;
+  // Per-cell data, far larger than cache, indexed through the Cell component.
+  struct CellData { float density; char padding[60]; };
+  vector<CellData> grid(1 << 20);
+  std::mt19937 random(42);
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.assign<Cell>(random() % grid.size());
+  }
+
+  auto iterate = [&]() {
+    AutoTimer t;
+    float total = 0;
+    ComponentHandle<Cell> cell;
+    for (auto e : em.entities_with_components(cell)) {
+      (void)e;
+      total += grid[cell->index].density;
+    }
+    return total;
+  };
+
+  cout << "iterating over " << count << " entities, randomly accessing cell data" << endl;
+  float before = iterate();
+  {
+    AutoTimer t;
+    cout << "sorting " << count << " entities by cell" << endl;
+    em.sort_by<Cell>([](const Cell &cell) { return cell.index; });
+  }
+  cout << "iterating over " << count << " entities sorted by cell" << endl;
+  float after = iterate();
+  REQUIRE(before == after);
+}
+
+template <bool Tuned>
+void benchmark_mixed_component_sizes(EntityManager &em) {
+  typedef Sized<4, Tuned> Small;
+  typedef Sized<64, Tuned> Medium;
+  typedef Sized<2048, Tuned> Large;
+  int count = 200000;
+  auto has_small = [](std::size_t i) { return true; };
+  auto has_medium = [](std::size_t i) { return i % 4 == 0; };
+  auto has_large = [](std::size_t i) { return i % 10000 == 0; };
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.template assign<Small>();
+    if (has_medium(i)) e.template assign<Medium>();
+    if (has_large(i)) e.template assign<Large>();
+  }
+
+  std::size_t bytes = pool_bytes<Small>(count, has_small) + pool_bytes<Medium>(count, has_medium) +
+      pool_bytes<Large>(count, has_large);
+  cout << "mixed size components (" << (Tuned ? "64KB chunks" : "8192 element chunks") << ") use "
+       << bytes / 1024 << "KB of pool memory" << endl;
+
+  AutoTimer t;
+  cout << "iterating 50 times over " << count << " entities with mixed size components" << endl;
+  ComponentHandle<Small> small;
+  ComponentHandle<Medium> medium;
+  ComponentHandle<Large> large;
+  std::size_t touched = 0;
+  for (int pass = 0; pass < 50; pass++) {
+    for (auto e : em.entities_with_components(small)) {
+      (void)e;
+      touched += small->data[0];
+    }
+    for (auto e : em.entities_with_components(small, medium)) {
+      (void)e;
+      touched += medium->data[0];
+    }
+    for (auto e : em.entities_with_components(large)) {
+      (void)e;
+      touched += large->data[0];
+    }
+  }
+  (void)touched;
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestMixedComponentSizesDefaultChunks") {
+  benchmark_mixed_component_sizes<false>(em);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestMixedComponentSizesTunedChunks") {
+  benchmark_mixed_component_sizes<true>(em);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestToggleTagComponent") {
+  int count = 10000000;
+  vector<Entity> entities;
+  for (int i = 0; i < count; i++) {
+    entities.push_back(em.create());
+  }
+
+  AutoTimer t;
+  cout << "assigning and removing a tag component on " << count << " entities" << endl;
+
+  for (auto &e : entities) {
+    e.assign<Position>();
+  }
+  for (auto &e : entities) {
+    e.remove<Position>();
+  }
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestCountFlaggedEntities") {
+  int count = 10000000;
+  std::mt19937 random(42);
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.set_flag<IsVisible>(random() % 4 == 0);
+  }
+
+  size_t by_mask = 0, by_flag = 0;
+  {
+    AutoTimer t;
+    cout << "counting visible entities among " << count << " by component mask" << endl;
+    for (auto e : em.entities_with_components<IsVisible>()) {
+      (void)e;
+      ++by_mask;
+    }
+  }
+  {
+    AutoTimer t;
+    cout << "counting visible entities among " << count << " by flag" << endl;
+    by_flag = em.entities_with_flags<IsVisible>().size();
+  }
+  REQUIRE(by_mask == by_flag);
+}
+
+struct Dead {};
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestEntityIterationExcludingComponent") {
+  int count = 10000000;
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.assign<Position>();
+    if (i % 2) e.assign<Dead>();
+  }
+
+  ComponentHandle<Position> position;
+  int alive = 0;
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities, skipping dead entities in the loop" << endl;
+    for (auto e : em.entities_with_components(position)) {
+      if (e.has_component<Dead>()) continue;
+      ++alive;
+    }
+  }
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities, excluding dead entities in the view" << endl;
+    for (auto e : em.entities_with_components(position).exclude<Dead>()) {
+      (void)e;
+      --alive;
+    }
+  }
+  REQUIRE(0 == alive);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestGroupIterationAndChurn") {
+  int count = 1000000;
+  int frames = 100;
+  std::vector<Entity> entities;
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.assign<Position>();
+    if (i % 100 == 0) e.assign<Direction>();
+    entities.push_back(e);
+  }
+
+  auto churn = [&]() {
+    for (int i = 1; i < count; i += 1000) {
+      entities[i].assign<Direction>();
+      entities[i].remove<Direction>();
+    }
+  };
+  {
+    AutoTimer t;
+    cout << "churning Direction on " << count / 1000 << " entities for " << frames << " frames without a group" << endl;
+    for (int frame = 0; frame < frames; frame++) churn();
+  }
+
+  int matched = 0;
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities with a view for " << frames << " frames" << endl;
+    for (int frame = 0; frame < frames; frame++) {
+      for (auto e : em.entities_with_components<Position, Direction>()) {
+        (void)e;
+        ++matched;
+      }
+    }
+  }
+
+  EntityManager::Group &group = em.group<Position, Direction>();
+  {
+    AutoTimer t;
+    cout << "churning Direction on " << count / 1000 << " entities for " << frames << " frames with a group" << endl;
+    for (int frame = 0; frame < frames; frame++) churn();
+  }
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities with a group for " << frames << " frames" << endl;
+    for (int frame = 0; frame < frames; frame++) {
+      for (auto e : group) {
+        (void)e;
+        --matched;
+      }
+    }
+  }
+  REQUIRE(0 == matched);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestOwningGroupIterationUnpackTwo") {
+  int count = 10000000;
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.assign<Transform>();
+    e.assign<Velocity>(1.0f);
+    e.assign<PackedTransform>();
+    e.assign<PackedVelocity>(1.0f);
+  }
+
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities, unpacking two components" << endl;
+    ComponentHandle<Transform> transform;
+    ComponentHandle<Velocity> velocity;
+    for (auto e : em.entities_with_components(transform, velocity)) {
+      (void)e;
+      transform->x += velocity->x;
+    }
+  }
+
+  EntityManager::Group &group = em.owning_group<PackedTransform, PackedVelocity>();
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities in an owning group" << endl;
+    PackedTransform *transform = group.data<PackedTransform>();
+    PackedVelocity *velocity = group.data<PackedVelocity>();
+    for (size_t i = 0; i < group.size(); i++) {
+      transform[i].x += velocity[i].x;
+    }
+  }
+  REQUIRE(1.0f == em.component<PackedTransform>(em.create_id(0))->x);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestIterateChangedComponents") {
+  int count = 1000000;
+  int changes = 1000;
+  std::vector<Entity> entities;
+  for (int i = 0; i < count; i++) {
+    auto e = em.create();
+    e.assign<Replicated>();
+    entities.push_back(e);
+  }
+  uint64_t tick = em.tick();
+  std::mt19937 random(42);
+  for (int i = 0; i < changes; i++) entities[random() % count].mark_changed<Replicated>();
+
+  int changed = 0;
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities, reprocessing all of them" << endl;
+    for (auto e : em.entities_with_components<Replicated>()) {
+      (void)e;
+      ++changed;
+    }
+  }
+  REQUIRE(count == changed);
+  changed = 0;
+  {
+    AutoTimer t;
+    cout << "iterating over " << count << " entities changed since the last tick" << endl;
+    for (auto e : em.entities_with_components<Replicated>().changed_since<Replicated>(tick)) {
+      (void)e;
+      ++changed;
+    }
+  }
+  REQUIRE(changed <= changes);
+  REQUIRE(changed > changes * 9 / 10);
+}
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestTrackAddedComponentsWithReceiverAndObserver") {
+  int count = 1000000;
+  std::vector<Entity> entities;
+  for (int i = 0; i < count; i++) entities.push_back(em.create());
+
+  CellTracker tracker;
+  ev.subscribe<ComponentAddedEvent<Cell>>(tracker);
+  {
+    AutoTimer t;
+    cout << "tracking " << count << " added components with a receiver" << endl;
+    for (auto &e : entities) e.assign<Cell>();
+    for (auto id : tracker.added) (void)id;
+    tracker.added.clear();
+  }
+  ev.unsubscribe<ComponentAddedEvent<Cell>>(tracker);
+  for (auto &e : entities) e.remove<Cell>();
+
+  EntityManager::Observer &added = em.observe_added<Cell>();
+  {
+    AutoTimer t;
+    cout << "tracking " << count << " added components with an observer" << endl;
+    for (auto &e : entities) e.assign<Cell>();
+    for (auto e : added) (void)e;
+    REQUIRE(static_cast<size_t>(count) == added.size());
+    added.clear();
+  }
+}
+
+namespace {
+void count_hook(void *context, Entity entity) {
+  ++*static_cast<int*>(context);
+}
+}  // namespace
+
+TEST_CASE_METHOD(BenchmarkFixture, "TestAssignRemoveWithHooks") {
+  int count = 1000000;
+  std::vector<Entity> entities;
+  for (int i = 0; i < count; i++) entities.push_back(em.create());
+
+  int registered = 0, calls = 0;
+  for (int hooks : {0, 1, 4}) {
+    for (; registered < hooks; registered++) {
+      em.on_construct<Cell>(&count_hook, &calls);
+      em.on_destroy<Cell>(&count_hook, &calls);
+    }
+    AutoTimer t;
+    cout << "assigning and removing a component on " << count << " entities with " << hooks << " hooks" << endl;
+    for (auto &e : entities) e.assign<Cell>();
+    for (auto &e : entities) e.remove<Cell>();
+  }
+  // Each of 0 + 1 + 4 construct and destroy hooks is called per entity.
+  REQUIRE(calls == 2 * 5 * count);
+}
+
+struct Ping {
+  explicit Ping(int value) : value(value) {}
+
+  int value;
+};
+
+struct PingReceiver : public Receiver<PingReceiver> {
+  void receive(const Ping &ping) { total += ping.value; }
+  void receive(const std::vector<Ping> &pings) {
+    for (const Ping &ping : pings) total += ping.value;
+  }
+
+  int total = 0;
+};
+
+TEST_CASE("TestEmitEvents") {
+  int count = 10000000;
+  for (int receivers : {0, 1, 8, 64}) {
+    EventManager ev;
+    std::vector<PingReceiver> pingers(receivers);
+    for (auto &pinger : pingers) ev.subscribe<Ping>(pinger);
+    AutoTimer t;
+    cout << "emitting " << count << " events to " << receivers << " receivers" << endl;
+    for (int i = 0; i < count; i++) ev.emit<Ping>(1);
+  }
+}
+
+TEST_CASE("TestQueueEvents") {
+  int count = 10000000;
+  for (bool batch : {false, true}) {
+    EventManager ev;
+    std::vector<PingReceiver> pingers(8);
+    for (auto &pinger : pingers) {
+      if (batch) {
+        ev.subscribe<std::vector<Ping>>(pinger);
+      } else {
+        ev.subscribe<Ping>(pinger);
+      }
+    }
+    AutoTimer t;
+    cout << "queueing " << count << " events to 8 " << (batch ? "batch" : "per-event") << " receivers" << endl;
+    for (int i = 0; i < count; i++) ev.enqueue<Ping>(1);
+    ev.update<Ping>();
+    REQUIRE(pingers[0].total == count);
+  }
+}
+
+struct Hit {
+  Hit(uint64_t target, int damage) : target(target), damage(damage) {}
+
+  uint64_t target;
+  int damage;
+};
+
+struct HitReceiver : public Receiver<HitReceiver> {
+  void receive(const Hit &hit) {
+    if (hit.target == target) total += hit.damage;
+  }
+
+  uint64_t target = 0;
+  int total = 0;
+};
+
+TEST_CASE("TestTargetedEvents") {
+  int listeners = 5000, count = 100000;
+  for (bool targeted : {false, true}) {
+    EventManager ev;
+    std::vector<HitReceiver> receivers(listeners);
+    for (int i = 0; i < listeners; i++) {
+      receivers[i].target = i;
+      if (targeted) {
+        ev.subscribe_to<Hit>(i, receivers[i]);
+      } else {
+        ev.subscribe<Hit>(receivers[i]);
+      }
+    }
+    AutoTimer t;
+    cout << (targeted ? "targeting " : "broadcasting ") << count << " events to " << listeners << " listeners" << endl;
+    for (int i = 0; i < count; i++) {
+      uint64_t target = i % listeners;
+      if (targeted) {
+        ev.emit_to<Hit>(target, target, 1);
+      } else {
+        ev.emit<Hit>(target, 1);
+      }
+    }
+    REQUIRE(receivers[0].total == count / listeners);
+  }
+}
+
+struct HeapSound {
+  explicit HeapSound(const std::vector<float> &samples) : samples(samples) {}
+
+  std::vector<float> samples;
+};
+
+struct ArenaSound {
+  ArenaSound(const float *samples, std::size_t count) : samples(samples), count(count) {}
+
+  const float *samples;
+  std::size_t count;
+};
+
+TEST_CASE("TestQueueEventPayloads") {
+  int count = 1000000, frames = 10;
+  std::vector<float> samples(16, 1.0f);
+  {
+    EventManager ev;
+    AutoTimer t;
+    cout << "queueing " << count << " events with heap allocated payloads" << endl;
+    for (int frame = 0; frame < frames; frame++) {
+      for (int i = 0; i < count / frames; i++) ev.enqueue<HeapSound>(samples);
+      ev.update_all();
+    }
+  }
+  {
+    EventManager ev;
+    AutoTimer t;
+    cout << "queueing " << count << " events with arena allocated payloads" << endl;
+    for (int frame = 0; frame < frames; frame++) {
+      for (int i = 0; i < count / frames; i++) {
+        ev.enqueue<ArenaSound>(ev.frame_arena().copy(samples.data(), samples.size()), samples.size());
+      }
+      ev.update_all();
+      ev.end_frame();
+    }
+  }
+}
+
+TEST_CASE("TestSubscriptionChurn") {
+  int receivers = 50000, rounds = 10;
+  EventManager ev;
+  std::vector<std::unique_ptr<PingReceiver>> pingers(receivers);
+  AutoTimer t;
+  cout << "subscribing and unsubscribing " << receivers << " receivers " << rounds << " times" << endl;
+  for (int round = 0; round < rounds; round++) {
+    for (auto &pinger : pingers) {
+      pinger.reset(new PingReceiver());
+      ev.subscribe<Ping>(*pinger);
+    }
+    // Unsubscribed out of subscription order, as entities die.
+    for (int i = 0; i < receivers; i += 2) pingers[i].reset();
+    for (int i = 1; i < receivers; i += 2) ev.unsubscribe<Ping>(*pingers[i]);
+  }
+  REQUIRE(ev.connected_receivers() == 0);
+}
+
+struct PingCollector : public Receiver<PingCollector> {
+  void receive(const Ping &ping) { pings.push_back(ping); }
+
+  std::vector<Ping> pings;
+};
+
+TEST_CASE("TestEventStreamReaders") {
+  int count = 1000000, readers = 4, frames = 10;
+  {
+    EventManager ev;
+    std::vector<PingCollector> collectors(readers);
+    for (auto &collector : collectors) ev.subscribe<Ping>(collector);
+    AutoTimer t;
+    cout << "collecting " << count << " events in each of " << readers << " subscribed readers" << endl;
+    int total = 0;
+    for (int frame = 0; frame < frames; frame++) {
+      for (int i = 0; i < count / frames; i++) ev.emit<Ping>(1);
+      for (auto &collector : collectors) {
+        for (const Ping &ping : collector.pings) total += ping.value;
+        collector.pings.clear();
+      }
+    }
+    REQUIRE(total == readers * count);
+  }
+  {
+    EventManager ev;
+    AutoTimer t;
+    cout << "reading " << count << " streamed events in each of " << readers << " readers" << endl;
+    int total = 0;
+    for (int frame = 0; frame <= frames; frame++) {
+      for (int reader = 0; reader < readers; reader++) {
+        for (const Ping &ping : ev.stream<Ping>()) total += ping.value;
+      }
+      if (frame < frames) {
+        for (int i = 0; i < count / frames; i++) ev.stream<Ping>().push(1);
+      }
+      ev.end_frame();
+    }
+    REQUIRE(total == readers * count);
+  }
+}
+
+struct Body {
+  float mass = 1.0f;
+};
+
+TEST_CASE("TestAssignWithDependencies") {
+  int count = 50000;
+  for (bool batch : {false, true}) {
+    EventManager ev;
+    EntityManager em(ev);
+    deps::Dependency<Body, Transform, Velocity> dependency;
+    dependency.configure_entities(em);
+    em.group<Body, Transform, Velocity>();
+    std::vector<Entity::Id> ids;
+    for (int i = 0; i < count; i++) ids.push_back(em.create().id());
+    AutoTimer t;
+    cout << "assigning " << count << " bodies with dependencies " << (batch ? "in a batch" : "one by one") << endl;
+    if (batch) {
+      em.assign_many<Body>(ids);
+    } else {
+      for (Entity::Id id : ids) em.assign<Body>(id);
+    }
+    REQUIRE(em.has_component<Velocity>(ids.back()));
+  }
+}
+
+// As Body, but with its dependencies declared at compile time.
+struct RequiredBody : Body {};
+
+namespace entityx {
+template <>
+struct Requires<RequiredBody> : ComponentList<Transform, Velocity> {};
+}  // namespace entityx
+
+TEST_CASE("TestAssignWithRequirements") {
+  int count = 50000;
+  for (bool batch : {false, true}) {
+    EventManager ev;
+    EntityManager em(ev);
+    em.group<RequiredBody, Transform, Velocity>();
+    std::vector<Entity::Id> ids;
+    for (int i = 0; i < count; i++) ids.push_back(em.create().id());
+    AutoTimer t;
+    cout << "assigning " << count << " bodies with requirements " << (batch ? "in a batch" : "one by one") << endl;
+    if (batch) {
+      em.assign_many<RequiredBody>(ids);
+    } else {
+      for (Entity::Id id : ids) em.assign<RequiredBody>(id);
+    }
+    REQUIRE(em.has_component<Velocity>(ids.back()));
+  }
+}
@@ -40,18 +40,167 @@ EntityManager::~EntityManager() {
 
 void EntityManager::reset() {
   for (Entity entity : entities_for_debugging()) entity.destroy();
+  // Groups may own pools, so they go too.
+  for (Group *group : groups_) delete group;
+  groups_.clear();
+  for (Observer *observer : observers_) delete observer;
+  observers_.clear();
   for (BasePool *pool : component_pools_) {
     if (pool) delete pool;
   }
   component_pools_.clear();
+  for (ChangeTicks *ticks : change_ticks_) delete ticks;
+  change_ticks_.clear();
   entity_component_mask_.clear();
   entity_version_.clear();
   free_list_.clear();
   index_counter_ = 0;
 }
 
+void EntityManager::relocate(const std::vector<uint32_t> &slots, const std::vector<uint32_t> &order) {
+  assert(slots.size() == order.size());
+  // The entity destined for slots[i] currently lives in order[i]. Only those
+  // that actually move are touched.
+  std::vector<uint32_t> from, to;
+  ComponentMask families;
+  for (size_t i = 0; i < order.size(); i++) {
+    if (order[i] == slots[i]) continue;
+    from.push_back(order[i]);
+    to.push_back(slots[i]);
+    families |= entity_component_mask_[order[i]];
+  }
+  if (from.empty()) return;
+
+  std::vector<std::pair<Entity::Id, Entity::Id>> relocated;
+  relocated.reserve(from.size());
+  for (size_t k = 0; k < from.size(); k++)
+    relocated.emplace_back(create_id(from[k]), Entity::Id(to[k], entity_version_[to[k]] + 1));
+
+  // Apply the permutation to each pool in one pass.
+  std::vector<uint32_t> pool_from, pool_to;
+  for (size_t i = 0; i < component_pools_.size(); i++) {
+    if (!families.test(i)) continue;
+    if (component_pools_[i]) {
+      pool_from.clear();
+      pool_to.clear();
+      for (size_t k = 0; k < from.size(); k++) {
+        if (!entity_component_mask_[from[k]].test(i)) continue;
+        pool_from.push_back(from[k]);
+        pool_to.push_back(to[k]);
+      }
+      component_pools_[i]->relocate(pool_from, pool_to);
+    }
+    if (i < change_ticks_.size() && change_ticks_[i]) change_ticks_[i]->relocate(from, to);
+  }
+
+  // Observed entries of live entities follow them, with their new ids.
+  // Entries of destroyed entities stay put.
+  std::vector<size_t> live;
+  for (Observer *observer : observers_) {
+    live.clear();
+    for (size_t k = 0; k < from.size(); k++) {
+      if (observer->contains(from[k]) && observer->ids_[observer->sparse_[from[k]]] == relocated[k].first)
+        live.push_back(k);
+    }
+    for (size_t k : live) observer->erase(from[k]);
+    for (size_t k : live) observer->insert(relocated[k].second);
+  }
+
+  std::vector<ComponentMask> masks(from.size());
+  for (size_t k = 0; k < from.size(); k++) masks[k] = entity_component_mask_[from[k]];
+  for (size_t k = 0; k < to.size(); k++) {
+    entity_component_mask_[to[k]] = masks[k];
+    // Invalidate outstanding Entity::Ids.
+    entity_version_[to[k]]++;
+  }
+  for (Group *group : groups_) populate(*group);
+  // Always emitted, as there is no other way to follow relocated entities.
+  event_manager_.emit<EntitiesRelocatedEvent>(std::move(relocated));
+}
+
+EntityManager::Group &EntityManager::group(const ComponentMask &mask, const std::vector<BasePackedPool*> &owned) {
+  Group *group = nullptr;
+  for (Group *existing : groups_) {
+    if (existing->mask_ == mask) group = existing;
+  }
+  if (group && (owned.empty() || !group->owned_.empty())) return *group;
+  if (!group) {
+    group = new Group(this, mask);
+    groups_.push_back(group);
+  }
+  // An existing non-owning group is promoted to an owning one.
+  for (Group *other : groups_) {
+    for (BasePackedPool *pool : other->owned_) {
+      assert(std::find(owned.begin(), owned.end(), pool) == owned.end() && "Components can be owned by only one group");
+      (void)pool;
+    }
+  }
+  group->owned_ = owned;
+  populate(*group);
+  return *group;
+}
+
+EntityManager::Observer &EntityManager::observer(Observer::Kind kind, const ComponentMask &mask) {
+  for (Observer *observer : observers_) {
+    if (observer->kind_ == kind && observer->mask_ == mask) return *observer;
+  }
+  Observer *observer = new Observer(this, kind, mask);
+  observers_.push_back(observer);
+  return *observer;
+}
+
+void EntityManager::update_queries(uint32_t index, const ComponentMask &before) {
+  const ComponentMask &mask = entity_component_mask_[index];
+  for (Group *group : groups_) {
+    bool matches = (mask & group->mask_) == group->mask_;
+    if (matches == group->contains(index)) continue;
+    if (matches) {
+      group->insert(index);
+    } else {
+      group->erase(index);
+    }
+  }
+  for (Observer *observer : observers_) {
+    bool matched = (before & observer->mask_) == observer->mask_;
+    bool matches = (mask & observer->mask_) == observer->mask_;
+    if (matched == matches) continue;
+    if (observer->kind_ == Observer::REMOVED) {
+      if (!matches) observer->insert(create_id(index));
+    } else if (matches) {
+      observer->insert(create_id(index));
+    } else {
+      observer->erase(index);
+    }
+  }
+}
+
+void EntityManager::notify_changed(uint32_t index, BaseComponent::Family family) {
+  for (Observer *observer : observers_) {
+    if (observer->kind_ == Observer::CHANGED && observer->mask_.test(family))
+      observer->insert(create_id(index));
+  }
+}
+
+void EntityManager::remove_dependents(Entity::Id id, BaseComponent::Family family) {
+  const ComponentMask dependents = dependents_[family];
+  for (size_t i = 0; i < dependent_removers_.size(); i++) {
+    // Removal cascades, so test the current mask each time.
+    if (dependents.test(i) && entity_component_mask_[id.index()].test(i))
+      dependent_removers_[i](*this, id);
+  }
+}
+
+void EntityManager::populate(Group &group) {
+  group.dense_.clear();
+  // Insert in descending order, so that iteration visits ascending indices.
+  for (size_t i = entity_component_mask_.size(); i-- > 0;) {
+    if ((entity_component_mask_[i] & group.mask_) == group.mask_) group.insert(uint32_t(i));
+  }
+}
+
 EntityCreatedEvent::~EntityCreatedEvent() {}
 EntityDestroyedEvent::~EntityDestroyedEvent() {}
+EntitiesRelocatedEvent::~EntitiesRelocatedEvent() {}
 
 
 }  // namespace entityx
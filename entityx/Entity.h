@@ -24,6 +24,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -154,6 +155,12 @@ public:
   template <typename C>
   bool has_component() const;
 
+  template <typename C>
+  void set_flag(bool value);
+
+  template <typename C>
+  void mark_changed();
+
   template <typename A, typename ... Args>
   void unpack(ComponentHandle<A> &a, ComponentHandle<Args> & ... args);
 
@@ -277,6 +284,69 @@ struct Component : public BaseComponent {
 };
 
 
+/**
+ * True if C is a tag, ie. an empty component that is trivial to construct and
+ * destroy. Tags are stored purely as a bit in the entity's component mask.
+ * Other empty components are stored in a pool like any other component, so
+ * that their constructors and destructors run.
+ */
+template <typename C>
+struct IsTag : std::integral_constant<bool,
+    std::is_empty<C>::value &&
+    std::is_trivially_default_constructible<C>::value &&
+    std::is_trivially_destructible<C>::value> {};
+
+
+/**
+ * True if C is a flag, ie. a tag stored in a FlagPool.
+ *
+ *     struct IsVisible {};
+ *
+ *     namespace entityx {
+ *     template <> struct PoolTraits<IsVisible> { typedef FlagPool PoolType; };
+ *     }
+ */
+template <typename C>
+struct IsFlag : std::integral_constant<bool,
+    IsTag<C>::value && std::is_same<typename PoolTraits<C>::PoolType, FlagPool>::value> {};
+
+
+/**
+ * Specialise to std::true_type to track modifications of components of type
+ * C, so that views can skip unchanged entities (see
+ * EntityManager::mark_changed() and View::changed_since()).
+ *
+ *     namespace entityx {
+ *     template <> struct TrackChanges<Position> : std::true_type {};
+ *     }
+ */
+template <typename C>
+struct TrackChanges : std::false_type {};
+
+
+/**
+ * A list of component types, see Requires.
+ */
+template <typename ... Components>
+struct ComponentList {};
+
+
+/**
+ * Specialise to declare the components that must always accompany C.
+ *
+ *     namespace entityx {
+ *     template <> struct Requires<Physics> : ComponentList<Position, Direction> {};
+ *     }
+ *
+ * EntityManager::assign<Physics>() then also default constructs whichever of
+ * Position and Direction, and transitively their requirements, the entity
+ * lacks. Removing Position or Direction first removes Physics. Requirements
+ * must not be circular.
+ */
+template <typename C>
+struct Requires : ComponentList<> {};
+
+
 /**
  * Emitted when an entity is added to the system.
  */
@@ -299,6 +369,20 @@ struct EntityDestroyedEvent : public Event<EntityDestroyedEvent> {
 };
 
 
+/**
+ * Emitted by EntityManager::sort() and sort_by() after relocating entities.
+ *
+ * Each pair is the (old, new) Entity::Id of a relocated entity, so that ids
+ * held elsewhere (eg. links between entities) can be updated.
+ */
+struct EntitiesRelocatedEvent : public Event<EntitiesRelocatedEvent> {
+  explicit EntitiesRelocatedEvent(std::vector<std::pair<Entity::Id, Entity::Id>> ids) : ids(std::move(ids)) {}
+  virtual ~EntitiesRelocatedEvent();
+
+  std::vector<std::pair<Entity::Id, Entity::Id>> ids;
+};
+
+
 /**
  * Emitted when any component is added to an entity.
  */
@@ -311,6 +395,18 @@ struct ComponentAddedEvent : public Event<ComponentAddedEvent<C>> {
   ComponentHandle<C> component;
 };
 
+/**
+ * Emitted once by EntityManager::assign_many() for a whole batch of entities.
+ */
+template <typename C>
+struct ComponentsAddedEvent : public Event<ComponentsAddedEvent<C>> {
+  ComponentsAddedEvent(EntityManager *manager, std::vector<Entity::Id> ids) :
+      manager(manager), ids(std::move(ids)) {}
+
+  EntityManager *manager;
+  std::vector<Entity::Id> ids;
+};
+
 /**
  * Emitted when any component is removed from an entity.
  */
@@ -334,6 +430,12 @@ class EntityManager : entityx::help::NonCopyable {
   explicit EntityManager(EventManager &event_manager);
   virtual ~EntityManager();
 
+  // Restricts a view to entities whose tracked component changed after a tick.
+  struct ChangeFilter {
+    const ChangeTicks *ticks = nullptr;
+    uint64_t since = 0;
+  };
+
   /// An iterator over a view of the entities in an EntityManager.
   /// If All is true it will iterate over all valid entities and will ignore the entity mask.
   template <class Delegate, bool All = false>
@@ -357,8 +459,10 @@ class EntityManager : entityx::help::NonCopyable {
         free_cursor_ = 0;
       }
     }
-    ViewIterator(EntityManager *manager, const ComponentMask mask, uint32_t index)
-        : manager_(manager), mask_(mask), i_(index), capacity_(manager_->capacity()), free_cursor_(~0UL) {
+    ViewIterator(EntityManager *manager, const ComponentMask mask, const ComponentMask exclude, uint32_t index,
+                 const ChangeFilter &changed = ChangeFilter())
+        : manager_(manager), mask_(mask), exclude_(exclude), changed_(changed), i_(index),
+          capacity_(manager_->capacity()), free_cursor_(~0UL) {
       if (All) {
         std::sort(manager_->free_list_.begin(), manager_->free_list_.end());
         free_cursor_ = 0;
@@ -366,8 +470,12 @@ class EntityManager : entityx::help::NonCopyable {
     }
 
     void next() {
-      while (i_ < capacity_ && !predicate()) {
-        ++i_;
+      if (changed_.ticks) {
+        next_changed();
+      } else {
+        while (i_ < capacity_ && !predicate()) {
+          ++i_;
+        }
       }
 
       if (i_ < capacity_) {
@@ -376,8 +484,23 @@ class EntityManager : entityx::help::NonCopyable {
       }
     }
 
+    // As next(), but skipping whole chunks that have not changed.
+    void next_changed() {
+      const size_t chunk_size = ChangeTicks::CHUNK_SIZE;
+      while (i_ < capacity_) {
+        if (i_ % chunk_size == 0 && changed_.ticks->chunk_tick(i_ / chunk_size) <= changed_.since) {
+          i_ += chunk_size;
+          continue;
+        }
+        if (changed_.ticks->tick(i_) > changed_.since && predicate()) return;
+        ++i_;
+      }
+      i_ = uint32_t(capacity_);
+    }
+
     inline bool predicate() {
-      return (All && valid_entity()) || (manager_->entity_component_mask_[i_] & mask_) == mask_;
+      const ComponentMask &mask = manager_->entity_component_mask_[i_];
+      return (All && valid_entity()) || ((mask & mask_) == mask_ && (mask & exclude_).none());
     }
 
     inline bool valid_entity() {
@@ -391,6 +514,8 @@ class EntityManager : entityx::help::NonCopyable {
 
     EntityManager *manager_;
     ComponentMask mask_;
+    ComponentMask exclude_;
+    ChangeFilter changed_;
     uint32_t i_;
     size_t capacity_;
     size_t free_cursor_;
@@ -403,7 +528,9 @@ class EntityManager : entityx::help::NonCopyable {
     public:
       Iterator(EntityManager *manager,
         const ComponentMask mask,
-        uint32_t index) : ViewIterator<Iterator, All>(manager, mask, index) {
+        const ComponentMask exclude,
+        const ChangeFilter &changed,
+        uint32_t index) : ViewIterator<Iterator, All>(manager, mask, exclude, index, changed) {
         ViewIterator<Iterator, All>::next();
       }
 
@@ -411,10 +538,30 @@ class EntityManager : entityx::help::NonCopyable {
     };
 
 
-    Iterator begin() { return Iterator(manager_, mask_, 0); }
-    Iterator end() { return Iterator(manager_, mask_, uint32_t(manager_->capacity())); }
-    const Iterator begin() const { return Iterator(manager_, mask_, 0); }
-    const Iterator end() const { return Iterator(manager_, mask_, manager_->capacity()); }
+    Iterator begin() { return Iterator(manager_, mask_, exclude_, changed_, 0); }
+    Iterator end() { return Iterator(manager_, mask_, exclude_, changed_, uint32_t(manager_->capacity())); }
+    const Iterator begin() const { return Iterator(manager_, mask_, exclude_, changed_, 0); }
+    const Iterator end() const { return Iterator(manager_, mask_, exclude_, changed_, manager_->capacity()); }
+
+    /// Skip entities that have any of the given components.
+    template <typename ... Components>
+    BaseView exclude() const {
+      BaseView view(*this);
+      view.exclude_ |= manager_->component_mask<Components...>();
+      return view;
+    }
+
+    /// Only visit entities that have the (tracked) component C, changed
+    /// after tick.
+    template <typename C>
+    BaseView changed_since(uint64_t tick) const {
+      static_assert(!All, "changed_since() is not supported when iterating all entities");
+      BaseView view(*this);
+      // Ticks outlive the component, so the mask rules out removed ones.
+      view.mask_ |= manager_->component_mask<C>();
+      view.changed_ = manager_->change_filter<C>(tick);
+      return view;
+    }
 
   private:
     friend class EntityManager;
@@ -425,6 +572,8 @@ class EntityManager : entityx::help::NonCopyable {
 
     EntityManager *manager_;
     ComponentMask mask_;
+    ComponentMask exclude_;
+    ChangeFilter changed_;
   };
 
   typedef BaseView<false> View;
@@ -461,8 +610,10 @@ class EntityManager : entityx::help::NonCopyable {
     public:
       Iterator(EntityManager *manager,
         const ComponentMask mask,
+        const ComponentMask exclude,
+        const ChangeFilter &changed,
         uint32_t index,
-        const Unpacker &unpacker) : ViewIterator<Iterator>(manager, mask, index), unpacker_(unpacker) {
+        const Unpacker &unpacker) : ViewIterator<Iterator>(manager, mask, exclude, index, changed), unpacker_(unpacker) {
         ViewIterator<Iterator>::next();
       }
 
@@ -475,10 +626,37 @@ class EntityManager : entityx::help::NonCopyable {
     };
 
 
-    Iterator begin() { return Iterator(manager_, mask_, 0, unpacker_); }
-    Iterator end() { return Iterator(manager_, mask_, manager_->capacity(), unpacker_); }
-    const Iterator begin() const { return Iterator(manager_, mask_, 0, unpacker_); }
-    const Iterator end() const { return Iterator(manager_, mask_, manager_->capacity(), unpacker_); }
+    Iterator begin() { return Iterator(manager_, mask_, exclude_, changed_, 0, unpacker_); }
+    Iterator end() { return Iterator(manager_, mask_, exclude_, changed_, manager_->capacity(), unpacker_); }
+    const Iterator begin() const { return Iterator(manager_, mask_, exclude_, changed_, 0, unpacker_); }
+    const Iterator end() const { return Iterator(manager_, mask_, exclude_, changed_, manager_->capacity(), unpacker_); }
+
+    /// Skip entities that have any of the given components.
+    template <typename ... Excluded>
+    UnpackingView exclude() const {
+      UnpackingView view(*this);
+      view.exclude_ |= manager_->component_mask<Excluded...>();
+      return view;
+    }
+
+    /// Also visit entities lacking any of the given components. Their
+    /// handles are unpacked only when present, and are otherwise empty.
+    template <typename ... Optional>
+    UnpackingView optional() const {
+      UnpackingView view(*this);
+      view.mask_ &= ~manager_->component_mask<Optional...>();
+      return view;
+    }
+
+    /// Only visit entities that have the (tracked) component C, changed
+    /// after tick.
+    template <typename C>
+    UnpackingView changed_since(uint64_t tick) const {
+      UnpackingView view(*this);
+      view.mask_ |= manager_->component_mask<C>();
+      view.changed_ = manager_->change_filter<C>(tick);
+      return view;
+    }
 
 
    private:
@@ -489,9 +667,265 @@ class EntityManager : entityx::help::NonCopyable {
 
     EntityManager *manager_;
     ComponentMask mask_;
+    ComponentMask exclude_;
+    ChangeFilter changed_;
     Unpacker unpacker_;
   };
 
+  /// A view over entities with all of the given flags set. Flag bits are
+  /// tested 64 entities at a time.
+  template <typename ... Flags>
+  class FlagView {
+   public:
+    class Iterator : public std::iterator<std::input_iterator_tag, Entity::Id> {
+     public:
+      Iterator &operator ++() {
+        bits_ &= bits_ - 1;
+        next();
+        return *this;
+      }
+      bool operator == (const Iterator &rhs) const { return word_ == rhs.word_ && bits_ == rhs.bits_; }
+      bool operator != (const Iterator &rhs) const { return !(*this == rhs); }
+      Entity operator * () const {
+        uint32_t index = uint32_t(word_ * 64 + FlagPool::lowest_bit(bits_));
+        return Entity(view_->manager_, view_->manager_->create_id(index));
+      }
+
+     private:
+      friend class FlagView;
+
+      Iterator(const FlagView *view, size_t word)
+          : view_(view), word_(word), bits_(word < view->words_ ? view->word(word) : 0) {
+        next();
+      }
+
+      void next() {
+        while (!bits_ && ++word_ < view_->words_) bits_ = view_->word(word_);
+        if (!bits_) word_ = view_->words_;
+      }
+
+      const FlagView *view_;
+      size_t word_;
+      uint64_t bits_;
+    };
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, words_); }
+
+    /// Number of entities with all of the flags set.
+    size_t size() const {
+      size_t count = 0;
+      for (size_t i = 0; i < words_; i++) count += FlagPool::popcount(word(i));
+      return count;
+    }
+
+   private:
+    friend class EntityManager;
+
+    explicit FlagView(EntityManager *manager)
+        : manager_(manager), pools_{manager->flag_pool<Flags>()...}, words_(~size_t(0)) {
+      for (const FlagPool *pool : pools_) words_ = std::min(words_, pool ? pool->words() : 0);
+    }
+
+    uint64_t word(size_t i) const {
+      uint64_t bits = ~uint64_t(0);
+      for (const FlagPool *pool : pools_) bits &= pool->word(i);
+      return bits;
+    }
+
+    EntityManager *manager_;
+    const FlagPool *pools_[sizeof...(Flags)];
+    size_t words_;
+  };
+
+  /**
+   * A persistent query over the entities with all of a set of components.
+   *
+   * Membership is maintained incrementally as components are assigned and
+   * removed, so iterating a group costs O(matches) with no per-entity tests.
+   * The trade-off is a small cost for each registered group on every
+   * assign(), remove() and destroy().
+   *
+   * Entities are visited in reverse order of insertion. Removing the current
+   * entity from the group while iterating is safe, and entities added while
+   * iterating are not visited.
+   *
+   * An owning group (see owning_group()) additionally keeps the components
+   * it owns packed in group order: the first size() elements of each owned
+   * PackedPool belong to the members, so they can be processed with plain
+   * array loops over data<C>().
+   */
+  class Group {
+   public:
+    class Iterator : public std::iterator<std::input_iterator_tag, Entity::Id> {
+     public:
+      Iterator &operator ++() {
+        // Clamp in case several members were removed by the loop body.
+        i_ = std::min(i_ - 1, group_->dense_.size());
+        return *this;
+      }
+      bool operator == (const Iterator &rhs) const { return i_ == rhs.i_; }
+      bool operator != (const Iterator &rhs) const { return i_ != rhs.i_; }
+      Entity operator * () const {
+        return Entity(group_->manager_, group_->manager_->create_id(group_->dense_[i_ - 1]));
+      }
+
+     private:
+      friend class Group;
+
+      Iterator(const Group *group, size_t i) : group_(group), i_(i) {}
+
+      const Group *group_;
+      size_t i_;
+    };
+
+    Iterator begin() const { return Iterator(this, dense_.size()); }
+    Iterator end() const { return Iterator(this, 0); }
+
+    size_t size() const { return dense_.size(); }
+
+    bool contains(uint32_t index) const {
+      return index < sparse_.size() && sparse_[index] < dense_.size() && dense_[sparse_[index]] == index;
+    }
+
+    /**
+     * Packed components of type C for all members of an owning group.
+     *
+     * Element i belongs to the same entity for every owned component. The
+     * pointer is invalidated when components of type C are assigned or
+     * removed.
+     */
+    template <typename C>
+    C *data() const {
+      typedef typename PoolTraits<C>::PoolType PoolType;
+      PoolType *pool = static_cast<PoolType*>(manager_->component_pools_[Component<C>::family()]);
+      assert(std::find(owned_.begin(), owned_.end(), pool) != owned_.end() && "C is not owned by this group");
+      return pool->data();
+    }
+
+   private:
+    friend class EntityManager;
+
+    Group(EntityManager *manager, const ComponentMask &mask) : manager_(manager), mask_(mask) {}
+
+    // Owned pools mirror every change to the order of dense_.
+    void insert(uint32_t index) {
+      if (sparse_.size() <= index) sparse_.resize(manager_->capacity());
+      for (BasePackedPool *pool : owned_) pool->swap_positions(pool->position(index), dense_.size());
+      sparse_[index] = uint32_t(dense_.size());
+      dense_.push_back(index);
+    }
+
+    void erase(uint32_t index) {
+      uint32_t position = sparse_[index];
+      for (BasePackedPool *pool : owned_) pool->swap_positions(position, dense_.size() - 1);
+      dense_[position] = dense_.back();
+      sparse_[dense_[position]] = position;
+      dense_.pop_back();
+    }
+
+    EntityManager *manager_;
+    ComponentMask mask_;
+    // Entity indices of all members.
+    std::vector<uint32_t> dense_;
+    // Position in dense_ of each member, indexed by entity index.
+    std::vector<uint32_t> sparse_;
+    // Component pools kept in the same order as dense_.
+    std::vector<BasePackedPool*> owned_;
+  };
+
+  /**
+   * A buffer of entities that underwent a particular change, filled directly
+   * by the EntityManager as it happens, and drained by the owner (typically
+   * once per frame) with clear().
+   *
+   * Entities appear at most once, in no particular order. Entities recorded
+   * by a removal observer may since have been destroyed, in which case they
+   * are no longer valid().
+   *
+   * @code
+   * EntityManager::Observer &spawned = entity_manager.observe_added<Position, Renderable>();
+   * ...
+   * for (Entity entity : spawned) create_sprite(entity);
+   * spawned.clear();
+   * @endcode
+   */
+  class Observer {
+   public:
+    enum Kind {
+      // Entities that came to have all of the components.
+      ADDED,
+      // Entities that stopped having all of the components.
+      REMOVED,
+      // Entities whose (tracked) component was assigned or changed.
+      CHANGED
+    };
+
+    class Iterator : public std::iterator<std::input_iterator_tag, Entity::Id> {
+     public:
+      Iterator &operator ++() {
+        ++i_;
+        return *this;
+      }
+      bool operator == (const Iterator &rhs) const { return i_ == rhs.i_; }
+      bool operator != (const Iterator &rhs) const { return i_ != rhs.i_; }
+      Entity operator * () const { return Entity(observer_->manager_, observer_->ids_[i_]); }
+
+     private:
+      friend class Observer;
+
+      Iterator(const Observer *observer, size_t i) : observer_(observer), i_(i) {}
+
+      const Observer *observer_;
+      size_t i_;
+    };
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, ids_.size()); }
+
+    size_t size() const { return ids_.size(); }
+    bool empty() const { return ids_.empty(); }
+
+    void clear() { ids_.clear(); }
+
+   private:
+    friend class EntityManager;
+
+    Observer(EntityManager *manager, Kind kind, const ComponentMask &mask)
+        : manager_(manager), kind_(kind), mask_(mask) {}
+
+    bool contains(uint32_t index) const {
+      return index < sparse_.size() && sparse_[index] < ids_.size() && ids_[sparse_[index]].index() == index;
+    }
+
+    void insert(Entity::Id id) {
+      uint32_t index = id.index();
+      if (contains(index)) {
+        // Supersedes any entry for a destroyed entity in the same slot.
+        ids_[sparse_[index]] = id;
+        return;
+      }
+      if (sparse_.size() <= index) sparse_.resize(manager_->capacity());
+      sparse_[index] = uint32_t(ids_.size());
+      ids_.push_back(id);
+    }
+
+    void erase(uint32_t index) {
+      if (!contains(index)) return;
+      uint32_t position = sparse_[index];
+      ids_[position] = ids_.back();
+      sparse_[ids_[position].index()] = position;
+      ids_.pop_back();
+    }
+
+    EntityManager *manager_;
+    Kind kind_;
+    ComponentMask mask_;
+    std::vector<Entity::Id> ids_;
+    // Position in ids_ of each entry, indexed by entity index.
+    std::vector<uint32_t> sparse_;
+  };
+
   /**
    * Number of managed entities.
    */
@@ -526,7 +960,7 @@ class EntityManager : entityx::help::NonCopyable {
        version = entity_version_[index];
     }
     Entity entity(this, Entity::Id(index, version));
-    event_manager_.emit<EntityCreatedEvent>(entity);
+    emit<EntityCreatedEvent>(entity);
     return entity;
   }
 
@@ -539,13 +973,19 @@ class EntityManager : entityx::help::NonCopyable {
     assert_valid(entity);
     uint32_t index = entity.index();
     auto mask = entity_component_mask_[entity.index()];
-    event_manager_.emit<EntityDestroyedEvent>(Entity(this, entity));
+    emit<EntityDestroyedEvent>(Entity(this, entity));
+    if (!component_hooks_.empty()) {
+      for (size_t i = 0; i < component_hooks_.size(); i++)
+        if (mask.test(i)) call_hooks(i, &ComponentHooks::destroy, entity);
+    }
+    // Leave groups first, so owning groups can unpack the components.
+    entity_component_mask_[index].reset();
+    if (has_queries()) update_queries(index, mask);
     for (size_t i = 0; i < component_pools_.size(); i++) {
       BasePool *pool = component_pools_[i];
       if (pool && mask.test(i))
         pool->destroy(index);
     }
-    entity_component_mask_[index].reset();
     entity_version_[index]++;
     free_list_.push_back(index);
   }
@@ -570,6 +1010,13 @@ class EntityManager : entityx::help::NonCopyable {
    *
    *     Position &position = em.assign<Position>(e, x, y);
    *
+   * Empty components (eg. `struct Enemy {};`) are tags: they have no storage
+   * and are never constructed or destroyed. Assigning one only sets its bit
+   * in the entity's component mask.
+   *
+   * Missing requirements of C (see Requires) are default constructed along
+   * with it, and notified before it.
+   *
    * @returns Smart pointer to newly created component.
    */
   template <typename C, typename ... Args>
@@ -579,21 +1026,80 @@ class EntityManager : entityx::help::NonCopyable {
     assert(!entity_component_mask_[id.index()].test(family));
 
     // Placement new into the component pool.
-    Pool<C> *pool = accomodate_component<C>();
-    new(pool->get(id.index())) C(std::forward<Args>(args) ...);
+    construct<C>(id.index(), IsTag<C>(), std::forward<Args>(args) ...);
+
+    // Set the bit for this component, and those of any requirements, before
+    // updating queries once.
+    if (HasRequirements<C>::value) {
+      const ComponentMask before = entity_component_mask_[id.index()];
+      entity_component_mask_[id.index()].set(family);
+      construct_required<C>(id.index());
+      if (has_queries()) update_queries(id.index(), before);
+      notify_required<C>(id, before);
+    } else {
+      entity_component_mask_[id.index()].set(family);
+      update_queries(id.index(), family);
+    }
 
-    // Set the bit for this component.
-    entity_component_mask_[id.index()].set(family);
+    call_hooks(family, &ComponentHooks::construct, id);
 
     // Create and return handle.
     ComponentHandle<C> component(this, id);
-    event_manager_.emit<ComponentAddedEvent<C>>(Entity(this, id), component);
+    emit<ComponentAddedEvent<C>>(Entity(this, id), component);
     return component;
   }
 
+  /**
+   * Assign a Component to each of a batch of entities, constructing each
+   * from the same arguments.
+   *
+   * Construct hooks registered with a batch form (see on_construct()) are
+   * called once for the whole batch, after every component is constructed.
+   * A single ComponentsAddedEvent<C> is emitted for the batch, as well as a
+   * ComponentAddedEvent<C> per entity if that has receivers.
+   */
+  template <typename C, typename ... Args>
+  void assign_many(const std::vector<Entity::Id> &ids, const Args & ... args) {
+    const BaseComponent::Family family = Component<C>::family();
+    for (Entity::Id id : ids) {
+      assert_valid(id);
+      assert(!entity_component_mask_[id.index()].test(family));
+      construct<C>(id.index(), IsTag<C>(), args ...);
+      if (HasRequirements<C>::value) {
+        const ComponentMask before = entity_component_mask_[id.index()];
+        entity_component_mask_[id.index()].set(family);
+        construct_required<C>(id.index());
+        if (has_queries()) update_queries(id.index(), before);
+        notify_required<C>(id, before);
+      } else {
+        entity_component_mask_[id.index()].set(family);
+        update_queries(id.index(), family);
+      }
+    }
+
+    if (family < component_hooks_.size()) {
+      // Hooks may register further hooks, so don't hold on to references.
+      for (size_t i = 0; i < component_hooks_[family].construct.size(); i++) {
+        BoundHook hook = component_hooks_[family].construct[i];
+        if (hook.batch) {
+          hook.batch(hook.context, *this, ids);
+        } else {
+          for (Entity::Id id : ids) hook.function(hook.context, Entity(this, id));
+        }
+      }
+    }
+
+    if (LIFECYCLE_EVENTS && event_manager_.has_receivers<ComponentAddedEvent<C>>()) {
+      for (Entity::Id id : ids) emit<ComponentAddedEvent<C>>(Entity(this, id), ComponentHandle<C>(this, id));
+    }
+    emit<ComponentsAddedEvent<C>>(this, ids);
+  }
+
   /**
    * Remove a Component from an Entity::Id
    *
+   * Components that require C (see Requires) are removed first.
+   *
    * Emits a ComponentRemovedEvent<C> event.
    */
   template <typename C>
@@ -602,16 +1108,159 @@ class EntityManager : entityx::help::NonCopyable {
     const BaseComponent::Family family = Component<C>::family();
     const uint32_t index = id.index();
 
-    // Find the pool for this component family.
-    BasePool *pool = component_pools_[family];
+    if (family < dependents_.size() && (entity_component_mask_[index] & dependents_[family]).any())
+      remove_dependents(id, family);
+
     ComponentHandle<C> component(this, id);
-    event_manager_.emit<ComponentRemovedEvent<C>>(Entity(this, id), component);
+    emit<ComponentRemovedEvent<C>>(Entity(this, id), component);
+    call_hooks(family, &ComponentHooks::destroy, id);
 
     // Remove component bit.
     entity_component_mask_[id.index()].reset(family);
+    update_queries(index, family);
+
+    // Call destructor. Tags are never constructed, but flags must be cleared.
+    if (!IsTag<C>::value || IsFlag<C>::value)
+      component_pools_[family]->destroy(index);
+  }
+
+  /**
+   * Set or clear a flag on an Entity::Id.
+   *
+   * This is equivalent to assigning or removing the (empty) flag component,
+   * but costs only a couple of bit operations. As with assign() and remove(),
+   * missing requirements of the flag (see Requires) are constructed when it
+   * is set, components requiring it are removed when it is cleared, and
+   * lifecycle hooks are called. No events are emitted for the flag itself.
+   *
+   *     em.set_flag<IsVisible>(id, in_frustum);
+   */
+  template <typename C>
+  void set_flag(Entity::Id id, bool value) {
+    static_assert(IsFlag<C>::value, "set_flag() requires a flag component, see IsFlag");
+    assert_valid(id);
+    const BaseComponent::Family family = Component<C>::family();
+    const uint32_t index = id.index();
+    if (entity_component_mask_[index].test(family) == value) return;
+    if (value) {
+      const ComponentMask before = entity_component_mask_[index];
+      entity_component_mask_[index].set(family);
+      set_flag_bit<C>(index, true, std::true_type());
+      if (HasRequirements<C>::value) {
+        construct_required<C>(index);
+        if (has_queries()) update_queries(index, before);
+        notify_required<C>(id, before);
+      } else {
+        update_queries(index, family);
+      }
+      call_hooks(family, &ComponentHooks::construct, id);
+    } else {
+      if (family < dependents_.size() && (entity_component_mask_[index] & dependents_[family]).any())
+        remove_dependents(id, family);
+      call_hooks(family, &ComponentHooks::destroy, id);
+      entity_component_mask_[index].reset(family);
+      set_flag_bit<C>(index, false, std::true_type());
+      update_queries(index, family);
+    }
+  }
+
+  /**
+   * The most recent change tick.
+   *
+   * Record this after processing changes, and pass it to changed_since() next
+   * time to visit only entities changed in between.
+   */
+  uint64_t tick() const { return tick_; }
+
+  /**
+   * Mark a Component of an Entity::Id as changed, calling its update hooks
+   * (see on_update()).
+   *
+   * Tracked components (see TrackChanges) are also marked when assigned, and
+   * when accessed through a non-const ComponentHandle.
+   */
+  template <typename C>
+  void mark_changed(Entity::Id id) {
+    assert_valid(id);
+    assert(has_component<C>(id));
+    touch<C>(id.index());
+    call_hooks(Component<C>::family(), &ComponentHooks::update, id);
+  }
+
+  /**
+   * A lifecycle hook: a plain function called with a user supplied context.
+   */
+  typedef void (*ComponentHook)(void *context, Entity entity);
+
+  /**
+   * Call hook(context, entity) whenever a Component is assigned to an entity.
+   *
+   * Hooks are called directly, after the component is constructed and before
+   * ComponentAddedEvent<C> is emitted. When no hooks are registered for a
+   * component, checking for them costs a single branch.
+   *
+   * @code
+   * static void on_physics(void *context, Entity entity) {
+   *   static_cast<PhysicsWorld*>(context)->add_body(entity);
+   * }
+   *
+   * entity_manager.on_construct<Physics>(&on_physics, &world);
+   * @endcode
+   */
+  template <typename C>
+  void on_construct(ComponentHook hook, void *context) {
+    assert(hook);
+    hooks<C>().construct.push_back(BoundHook{hook, nullptr, context});
+  }
 
-    // Call destructor.
-    pool->destroy(index);
+  /**
+   * A lifecycle hook for a batch of entities.
+   */
+  typedef void (*ComponentBatchHook)(void *context, EntityManager &manager, const std::vector<Entity::Id> &ids);
+
+  /**
+   * As on_construct(hook, context), but assign_many() calls batch once with
+   * all of the entities it assigned the Component to, rather than calling
+   * hook for each of them. hook is still required, as assign() calls it.
+   */
+  template <typename C>
+  void on_construct(ComponentHook hook, ComponentBatchHook batch, void *context) {
+    assert(hook && batch);
+    hooks<C>().construct.push_back(BoundHook{hook, batch, context});
+  }
+
+  /**
+   * Call hook(context, entity) whenever a Component is removed from an
+   * entity, including when the entity is destroyed. The component is still
+   * accessible when the hook is called.
+   */
+  template <typename C>
+  void on_destroy(ComponentHook hook, void *context) {
+    assert(hook);
+    hooks<C>().destroy.push_back(BoundHook{hook, nullptr, context});
+  }
+
+  /**
+   * Call hook(context, entity) whenever a Component is marked as changed, by
+   * mark_changed() or Entity::replace().
+   */
+  template <typename C>
+  void on_update(ComponentHook hook, void *context) {
+    assert(hook);
+    hooks<C>().update.push_back(BoundHook{hook, nullptr, context});
+  }
+
+  /**
+   * Remove all hooks of a Component registered with context.
+   */
+  template <typename C>
+  void remove_hooks(void *context) {
+    ComponentHooks &component_hooks = hooks<C>();
+    for (std::vector<BoundHook> *list : {&component_hooks.construct, &component_hooks.destroy, &component_hooks.update}) {
+      list->erase(std::remove_if(list->begin(), list->end(),
+                                 [context](const BoundHook &hook) { return hook.context == context; }),
+                  list->end());
+    }
   }
 
   /**
@@ -621,13 +1270,7 @@ class EntityManager : entityx::help::NonCopyable {
   bool has_component(Entity::Id id) const {
     assert_valid(id);
     size_t family = Component<C>::family();
-    // We don't bother checking the component mask, as we return a nullptr anyway.
-    if (family >= component_pools_.size())
-      return false;
-    BasePool *pool = component_pools_[family];
-    if (!pool || !entity_component_mask_[id.index()][family])
-      return false;
-    return true;
+    return entity_component_mask_[id.index()][family];
   }
 
   /**
@@ -639,11 +1282,7 @@ class EntityManager : entityx::help::NonCopyable {
   ComponentHandle<C> component(Entity::Id id) {
     assert_valid(id);
     size_t family = Component<C>::family();
-    // We don't bother checking the component mask, as we return a nullptr anyway.
-    if (family >= component_pools_.size())
-      return ComponentHandle<C>();
-    BasePool *pool = component_pools_[family];
-    if (!pool || !entity_component_mask_[id.index()][family])
+    if (!entity_component_mask_[id.index()][family])
       return ComponentHandle<C>();
     return ComponentHandle<C>(this, id);
   }
@@ -657,11 +1296,7 @@ class EntityManager : entityx::help::NonCopyable {
   const ComponentHandle<const C> component(Entity::Id id) const {
     assert_valid(id);
     size_t family = Component<C>::family();
-    // We don't bother checking the component mask, as we return a nullptr anyway.
-    if (family >= component_pools_.size())
-      return ComponentHandle<const C>();
-    BasePool *pool = component_pools_[family];
-    if (!pool || !entity_component_mask_[id.index()][family])
+    if (!entity_component_mask_[id.index()][family])
       return ComponentHandle<const C>();
     return ComponentHandle<const C>(this, id);
   }
@@ -705,6 +1340,17 @@ class EntityManager : entityx::help::NonCopyable {
    *   // Use position and component here.
    * }
    * @endcode
+   *
+   * Entities with unwanted components can be skipped, and components marked as
+   * optional, without testing each entity in the loop body:
+   *
+   * @code
+   * ComponentHandle<Shield> shield;
+   * for (Entity entity : entity_manager.entities_with_components(position, shield)
+   *                          .exclude<Dead, Frozen>().optional<Shield>()) {
+   *   if (shield) ...
+   * }
+   * @endcode
    */
   template <typename ... Components>
   UnpackingView<Components...> entities_with_components(ComponentHandle<Components> & ... components) {
@@ -712,6 +1358,91 @@ class EntityManager : entityx::help::NonCopyable {
     return UnpackingView<Components...>(this, mask, components...);
   }
 
+  /**
+   * Find Entities that have all of the specified flags set.
+   *
+   * Flags are tested 64 entities at a time, so this is much faster than
+   * entities_with_components() for sparse flags. Counting is faster still:
+   *
+   * @code
+   * size_t visible = entity_manager.entities_with_flags<IsVisible>().size();
+   * @endcode
+   */
+  template <typename ... Flags>
+  FlagView<Flags...> entities_with_flags() {
+    static_assert(sizeof...(Flags) > 0, "entities_with_flags() requires at least one flag");
+    return FlagView<Flags...>(this);
+  }
+
+  /**
+   * Register (or retrieve the existing) persistent Group of entities with all
+   * of the specified Components.
+   *
+   * @code
+   * EntityManager::Group &movable = entity_manager.group<Position, Direction>();
+   * for (Entity entity : movable) {}
+   * @endcode
+   */
+  template <typename ... Components>
+  Group &group() {
+    return group(component_mask<Components...>(), {});
+  }
+
+  /**
+   * Register a Group that also owns the storage of its Components, which
+   * must all be stored in a PackedPool (see PoolTraits).
+   *
+   * Assigning or removing an owned component, or destroying an entity with
+   * one, costs an extra swap per owned component. A component can be owned
+   * by only one group.
+   *
+   * @code
+   * EntityManager::Group &movable = entity_manager.owning_group<Transform, Velocity>();
+   * Transform *transform = movable.data<Transform>();
+   * Velocity *velocity = movable.data<Velocity>();
+   * for (size_t i = 0; i < movable.size(); i++) {
+   *   transform[i].x += velocity[i].x;
+   * }
+   * @endcode
+   */
+  template <typename ... Components>
+  Group &owning_group() {
+    // Fails to compile unless all Components are stored in a PackedPool.
+    std::vector<BasePackedPool*> owned = {accomodate_component<Components>()...};
+    return group(component_mask<Components...>(), owned);
+  }
+
+  /**
+   * Register (or retrieve the existing) Observer of entities that come to
+   * have all of the specified Components, by assignment. Entities that stop
+   * matching before the observer is cleared are dropped from it.
+   */
+  template <typename ... Components>
+  Observer &observe_added() {
+    return observer(Observer::ADDED, component_mask<Components...>());
+  }
+
+  /**
+   * Register (or retrieve the existing) Observer of entities that stop
+   * having all of the specified Components, by removal or destruction.
+   */
+  template <typename ... Components>
+  Observer &observe_removed() {
+    return observer(Observer::REMOVED, component_mask<Components...>());
+  }
+
+  /**
+   * Register (or retrieve the existing) Observer of entities whose tracked
+   * Component (see TrackChanges) is assigned or marked as changed. Entities
+   * that lose the component before the observer is cleared are dropped from
+   * it.
+   */
+  template <typename C>
+  Observer &observe_changed() {
+    static_assert(TrackChanges<C>::value, "observe_changed() requires a tracked component, see TrackChanges");
+    return observer(Observer::CHANGED, component_mask<C>());
+  }
+
   /**
    * Iterate over all *valid* entities (ie. not in the free list). Not fast,
    * so should only be used for debugging.
@@ -749,8 +1480,68 @@ class EntityManager : entityx::help::NonCopyable {
     unpack<Args ...>(id, args ...);
   }
 
+  /**
+   * Sort all entities with component C, relocating them (along with all of
+   * their other components) within the slots they already occupy.
+   *
+   * Views subsequently visit these entities in sorted order, so systems that
+   * access other data in the same order (eg. by spatial cell or material) get
+   * far better cache behaviour.
+   *
+   * NOTE: Relocated entities are assigned new Entity::Ids. Any existing
+   * Entity or ComponentHandle referring to a relocated entity is invalidated.
+   * An EntitiesRelocatedEvent maps the old ids to the new ones.
+   *
+   * @code
+   * em.sort<Renderable>([](const Renderable &a, const Renderable &b) {
+   *   return a.material < b.material;
+   * });
+   * @endcode
+   */
+  template <typename C, typename Compare>
+  void sort(Compare compare) {
+    static_assert(!IsTag<C>::value, "Tags can not be sorted");
+    std::vector<uint32_t> slots = slots_with_component<C>();
+    std::vector<uint32_t> order(slots);
+    const typename PoolTraits<C>::PoolType *pool = accomodate_component<C>();
+    std::stable_sort(order.begin(), order.end(), [pool, &compare](uint32_t a, uint32_t b) {
+      return compare(*static_cast<const C*>(pool->get(a)), *static_cast<const C*>(pool->get(b)));
+    });
+    relocate(slots, order);
+  }
+
+  /**
+   * Sort all entities with component C by a key extracted from C.
+   *
+   * Keys are extracted once per entity, so this is preferable to sort() when
+   * the key is expensive to compute. See sort() for invalidation semantics.
+   *
+   * @code
+   * em.sort_by<Position>([](const Position &p) { return grid.cell(p.x, p.y); });
+   * @endcode
+   */
+  template <typename C, typename Key>
+  void sort_by(Key key) {
+    static_assert(!IsTag<C>::value, "Tags can not be sorted");
+    typedef typename std::decay<decltype(key(std::declval<const C&>()))>::type K;
+    std::vector<uint32_t> slots = slots_with_component<C>();
+    const typename PoolTraits<C>::PoolType *pool = accomodate_component<C>();
+    std::vector<std::pair<K, uint32_t>> keyed;
+    keyed.reserve(slots.size());
+    for (uint32_t slot : slots)
+      keyed.emplace_back(key(*static_cast<const C*>(pool->get(slot))), slot);
+    std::stable_sort(keyed.begin(), keyed.end(),
+        [](const std::pair<K, uint32_t> &a, const std::pair<K, uint32_t> &b) { return a.first < b.first; });
+    std::vector<uint32_t> order;
+    order.reserve(keyed.size());
+    for (auto &k : keyed) order.push_back(k.second);
+    relocate(slots, order);
+  }
+
   /**
    * Destroy all entities and reset the EntityManager.
+   *
+   * Registered groups and observers are discarded.
    */
   void reset();
 
@@ -767,19 +1558,158 @@ class EntityManager : entityx::help::NonCopyable {
   template <typename C>
   C *get_component_ptr(Entity::Id id) {
     assert(valid(id));
-    BasePool *pool = component_pools_[Component<C>::family()];
-    assert(pool);
-    return static_cast<C*>(pool->get(id.index()));
+    return component_ptr<C>(id.index(), IsTag<C>());
   }
 
   template <typename C>
   const C *get_component_ptr(Entity::Id id) const {
     assert_valid(id);
-    BasePool *pool = component_pools_[Component<C>::family()];
+    return component_ptr<C>(id.index(), IsTag<C>());
+  }
+
+  template <typename C>
+  C *component_ptr(uint32_t index, std::false_type) const {
+    typedef typename PoolTraits<typename std::remove_const<C>::type>::PoolType PoolType;
+    PoolType *pool = static_cast<PoolType*>(component_pools_[Component<C>::family()]);
     assert(pool);
-    return static_cast<const C*>(pool->get(id.index()));
+    return static_cast<C*>(pool->get(index));
+  }
+
+  // Tags have no storage or state, so all handles share one instance.
+  template <typename C>
+  C *component_ptr(uint32_t index, std::true_type) const {
+    static typename std::remove_const<C>::type instance;
+    return &instance;
+  }
+
+  template <typename C, typename ... Args>
+  void construct(uint32_t index, std::false_type, Args && ... args) {
+    typename PoolTraits<C>::PoolType *pool = accomodate_component<C>();
+    new(pool->allocate(index)) C(std::forward<Args>(args) ...);
+    touch<C>(index);
+  }
+
+  template <typename C>
+  struct HasRequirements : std::integral_constant<bool,
+      !std::is_base_of<ComponentList<>, Requires<C>>::value> {};
+
+  // Default construct the missing requirements of C, and theirs, setting
+  // their bits in the component mask. The closure is expanded at compile
+  // time; only the reverse mapping used by remove() is built at runtime.
+  template <typename C>
+  void construct_required(uint32_t index) {
+    register_dependent<C>();
+    construct_required(index, Requires<C>());
+  }
+
+  void construct_required(uint32_t index, ComponentList<>) {}
+
+  template <typename ... Ds>
+  void construct_required(uint32_t index, ComponentList<Ds...>) {
+    int expand[] = {0, (construct_requirement<Ds>(index), 0)...};
+    (void)expand;
   }
 
+  template <typename D>
+  void construct_requirement(uint32_t index) {
+    const BaseComponent::Family family = Component<D>::family();
+    if (entity_component_mask_[index].test(family)) return;
+    construct<D>(index, IsTag<D>());
+    entity_component_mask_[index].set(family);
+    if (HasRequirements<D>::value) construct_required<D>(index);
+  }
+
+  // Call construct hooks and emit ComponentAddedEvent for the requirements of
+  // C assigned since before, deepest first.
+  template <typename C>
+  void notify_required(Entity::Id id, const ComponentMask &before) {
+    ComponentMask pending = entity_component_mask_[id.index()] & ~before;
+    notify_required(id, pending, Requires<C>());
+  }
+
+  void notify_required(Entity::Id id, ComponentMask &pending, ComponentList<>) {}
+
+  template <typename ... Ds>
+  void notify_required(Entity::Id id, ComponentMask &pending, ComponentList<Ds...>) {
+    int expand[] = {0, (notify_requirement<Ds>(id, pending), 0)...};
+    (void)expand;
+  }
+
+  template <typename D>
+  void notify_requirement(Entity::Id id, ComponentMask &pending) {
+    const BaseComponent::Family family = Component<D>::family();
+    if (!pending.test(family)) return;
+    pending.reset(family);
+    notify_required(id, pending, Requires<D>());
+    call_hooks(family, &ComponentHooks::construct, id);
+    emit<ComponentAddedEvent<D>>(Entity(this, id), ComponentHandle<D>(this, id));
+  }
+
+  template <typename C>
+  void register_dependent() {
+    if (!HasRequirements<C>::value) return;
+    const BaseComponent::Family family = Component<C>::family();
+    if (family < dependent_removers_.size() && dependent_removers_[family]) return;
+    if (dependent_removers_.size() <= family) dependent_removers_.resize(family + 1, nullptr);
+    dependent_removers_[family] = &EntityManager::remove_dependent<C>;
+    register_requirements(family, Requires<C>());
+  }
+
+  void register_requirements(BaseComponent::Family dependent, ComponentList<>) {}
+
+  template <typename ... Ds>
+  void register_requirements(BaseComponent::Family dependent, ComponentList<Ds...>) {
+    int expand[] = {0, (register_requirement<Ds>(dependent), 0)...};
+    (void)expand;
+  }
+
+  template <typename D>
+  void register_requirement(BaseComponent::Family dependent) {
+    const BaseComponent::Family family = Component<D>::family();
+    if (dependents_.size() <= family) dependents_.resize(family + 1);
+    dependents_[family].set(dependent);
+  }
+
+  template <typename C>
+  static void remove_dependent(EntityManager &manager, Entity::Id id) {
+    manager.remove<C>(id);
+  }
+
+  // Remove the components of an entity that require family.
+  void remove_dependents(Entity::Id id, BaseComponent::Family family);
+
+  // Tags are stored purely as a bit in the component mask, and in a FlagPool
+  // if they are flags.
+  template <typename C, typename ... Args>
+  void construct(uint32_t index, std::true_type, Args && ... args) {
+    static_assert(sizeof...(Args) == 0, "Tags are not constructed from arguments");
+    set_flag_bit<C>(index, true, IsFlag<C>());
+  }
+
+  // Copying a tag (eg. by assign_from_copy()) has nothing to copy.
+  template <typename C, typename T,
+            typename = typename std::enable_if<std::is_same<typename std::decay<T>::type, C>::value>::type>
+  void construct(uint32_t index, std::true_type, T &&) {
+    set_flag_bit<C>(index, true, IsFlag<C>());
+  }
+
+  template <typename C>
+  void set_flag_bit(uint32_t index, bool value, std::true_type) {
+    FlagPool *pool = accomodate_component<C>();
+    if (value) pool->set(index); else pool->reset(index);
+  }
+
+  template <typename C>
+  void set_flag_bit(uint32_t index, bool value, std::false_type) {}
+
+  template <typename C>
+  FlagPool *flag_pool() const {
+    static_assert(IsFlag<C>::value, "Flag views require flag components, see IsFlag");
+    const BaseComponent::Family family = Component<C>::family();
+    return family < component_pools_.size() ? static_cast<FlagPool*>(component_pools_[family]) : nullptr;
+  }
+
+
   ComponentMask component_mask(Entity::Id id) {
     assert_valid(id);
     return entity_component_mask_.at(id.index());
@@ -807,27 +1737,132 @@ class EntityManager : entityx::help::NonCopyable {
     return component_mask<C1, Components ...>();
   }
 
+  Group &group(const ComponentMask &mask, const std::vector<BasePackedPool*> &owned);
+
+  Observer &observer(Observer::Kind kind, const ComponentMask &mask);
+
+  // Emit a lifecycle event, unless disabled by ENTITYX_LIFECYCLE_EVENTS.
+  template <typename E, typename ... Args>
+  inline void emit(Args && ... args) {
+    if (LIFECYCLE_EVENTS) event_manager_.emit<E>(std::forward<Args>(args) ...);
+  }
+
+  struct BoundHook {
+    ComponentHook function;
+    // Optional, for construct hooks.
+    ComponentBatchHook batch;
+    void *context;
+  };
+
+  struct ComponentHooks {
+    std::vector<BoundHook> construct;
+    std::vector<BoundHook> destroy;
+    std::vector<BoundHook> update;
+  };
+
+  template <typename C>
+  ComponentHooks &hooks() {
+    BaseComponent::Family family = Component<C>::family();
+    if (component_hooks_.size() <= family) component_hooks_.resize(family + 1);
+    return component_hooks_[family];
+  }
+
+  inline void call_hooks(BaseComponent::Family family, std::vector<BoundHook> ComponentHooks::*list, Entity::Id id) {
+    if (family >= component_hooks_.size()) return;
+    // Hooks may register further hooks, so don't hold on to references.
+    for (size_t i = 0; i < (component_hooks_[family].*list).size(); i++) {
+      BoundHook hook = (component_hooks_[family].*list)[i];
+      hook.function(hook.context, Entity(this, id));
+    }
+  }
+
+  inline bool has_queries() const {
+    return !groups_.empty() || !observers_.empty();
+  }
+
+  // Bring groups and observers up to date after a single component of an
+  // entity was assigned or removed.
+  inline void update_queries(uint32_t index, BaseComponent::Family toggled) {
+    if (!has_queries()) return;
+    ComponentMask before = entity_component_mask_[index];
+    before.flip(toggled);
+    update_queries(index, before);
+  }
+
+  void update_queries(uint32_t index, const ComponentMask &before);
+  void notify_changed(uint32_t index, BaseComponent::Family family);
+  void populate(Group &group);
+
+  // Ascending slot indices of all entities with component C.
+  template <typename C>
+  std::vector<uint32_t> slots_with_component() {
+    std::vector<uint32_t> slots;
+    const BaseComponent::Family family = Component<C>::family();
+    for (uint32_t i = 0; i < entity_component_mask_.size(); i++)
+      if (entity_component_mask_[i].test(family)) slots.push_back(i);
+    return slots;
+  }
+
+  // Move the entity in slot order[i] to slot slots[i], for all i.
+  void relocate(const std::vector<uint32_t> &slots, const std::vector<uint32_t> &order);
+
   inline void accomodate_entity(uint32_t index) {
     if (entity_component_mask_.size() <= index) {
       entity_component_mask_.resize(index + 1);
       entity_version_.resize(index + 1);
       for (BasePool *pool : component_pools_)
-        if (pool) pool->expand(index + 1);
+        if (pool) pool->resize(index + 1);
+      for (ChangeTicks *ticks : change_ticks_)
+        if (ticks) ticks->resize(index + 1);
     }
   }
 
+  // Mark component C of an entity as changed, if C is tracked.
   template <typename C>
-  Pool<C> *accomodate_component() {
+  inline void touch(uint32_t index) {
+    static_assert(!TrackChanges<C>::value || !IsTag<C>::value, "Tags can not be tracked");
+    if (TrackChanges<C>::value) {
+      change_ticks_[Component<C>::family()]->mark(index, ++tick_);
+      if (!observers_.empty()) notify_changed(index, Component<C>::family());
+    }
+  }
+
+  // Mutable access through a ComponentHandle<C> marks C as changed.
+  template <typename C>
+  inline void touch_mutable(uint32_t index) {
+    if (!std::is_const<C>::value) touch<typename std::remove_const<C>::type>(index);
+  }
+
+  template <typename C>
+  ChangeFilter change_filter(uint64_t since) {
+    static_assert(TrackChanges<C>::value, "changed_since() requires a tracked component, see TrackChanges");
+    accomodate_component<C>();
+    ChangeFilter filter;
+    filter.ticks = change_ticks_[Component<C>::family()];
+    filter.since = since;
+    return filter;
+  }
+
+  template <typename C>
+  typename PoolTraits<C>::PoolType *accomodate_component() {
+    typedef typename PoolTraits<C>::PoolType PoolType;
+    static_assert(!std::is_same<PoolType, FlagPool>::value || IsTag<C>::value,
+                  "FlagPool can only store tags, see IsFlag");
     BaseComponent::Family family = Component<C>::family();
     if (component_pools_.size() <= family) {
       component_pools_.resize(family + 1, nullptr);
     }
     if (!component_pools_[family]) {
-      Pool<C> *pool = new Pool<C>();
-      pool->expand(index_counter_);
+      PoolType *pool = new PoolType();
+      pool->resize(index_counter_);
       component_pools_[family] = pool;
+      if (TrackChanges<C>::value) {
+        if (change_ticks_.size() <= family) change_ticks_.resize(family + 1, nullptr);
+        change_ticks_[family] = new ChangeTicks();
+        change_ticks_[family]->resize(index_counter_);
+      }
     }
-    return static_cast<Pool<C>*>(component_pools_[family]);
+    return static_cast<PoolType*>(component_pools_[family]);
   }
 
 
@@ -843,12 +1878,26 @@ class EntityManager : entityx::help::NonCopyable {
   std::vector<uint32_t> entity_version_;
   // List of available entity slots.
   std::vector<uint32_t> free_list_;
+  // Persistent queries, updated whenever an entity's component mask changes.
+  std::vector<Group*> groups_;
+  std::vector<Observer*> observers_;
+  // Lifecycle hooks, indexed by family. Empty until a hook is registered.
+  std::vector<ComponentHooks> component_hooks_;
+  // Components with requirements (see Requires), indexed by the family they
+  // require, and how to remove them. Registered on first assignment.
+  std::vector<ComponentMask> dependents_;
+  std::vector<void (*)(EntityManager &, Entity::Id)> dependent_removers_;
+  // Modification ticks of tracked components, indexed by family.
+  std::vector<ChangeTicks*> change_ticks_;
+  uint64_t tick_ = 0;
 };
 
 
 template <typename C>
 BaseComponent::Family Component<C>::family() {
-  static Family family = family_counter_++;
+  // const C shares the family of C, so that const handles find their component.
+  static Family family = std::is_const<C>::value ?
+      Component<typename std::remove_const<C>::type>::family() : family_counter_++;
   assert(family < entityx::MAX_COMPONENTS);
   return family;
 }
@@ -879,14 +1928,13 @@ ComponentHandle<C> Entity::get_or_assign() {
 template <typename C, typename ... Args>
 ComponentHandle<C> Entity::replace(Args && ... args) {
   assert(valid());
-  auto handle = component<C>();
-  if (handle) {
-    *(handle.get()) = C(std::forward<Args>(args) ...);
-  }
-  else {
-    handle = manager_->assign<C>(id_, std::forward<Args>(args) ...);
+  if (has_component<C>()) {
+    // Bypass the handle, which would mark C as changed a second time.
+    *manager_->get_component_ptr<C>(id_) = C(std::forward<Args>(args) ...);
+    manager_->mark_changed<C>(id_);
+    return component<C>();
   }
-  return handle;
+  return manager_->assign<C>(id_, std::forward<Args>(args) ...);
 }
 
 template <typename C>
@@ -926,6 +1974,18 @@ bool Entity::has_component() const {
   return manager_->has_component<C>(id_);
 }
 
+template <typename C>
+void Entity::set_flag(bool value) {
+  assert(valid());
+  manager_->set_flag<C>(id_, value);
+}
+
+template <typename C>
+void Entity::mark_changed() {
+  assert(valid());
+  manager_->mark_changed<C>(id_);
+}
+
 template <typename A, typename ... Args>
 void Entity::unpack(ComponentHandle<A> &a, ComponentHandle<Args> & ... args) {
   assert(valid());
@@ -961,6 +2021,7 @@ inline bool ComponentHandle<C>::valid() const {
 template <typename C>
 inline C *ComponentHandle<C>::operator -> () {
   assert(valid());
+  manager_->touch_mutable<C>(id_.index());
   return manager_->get_component_ptr<C>(id_);
 }
 
@@ -973,6 +2034,7 @@ inline const C *ComponentHandle<C>::operator -> () const {
 template <typename C>
 inline C *ComponentHandle<C>::get() {
   assert(valid());
+  manager_->touch_mutable<C>(id_.index());
   return manager_->get_component_ptr<C>(id_);
 }
 
@@ -70,6 +70,55 @@ ostream &operator<<(ostream &out, const Direction &direction) {
   return out;
 }
 
+// A component stored in a ContiguousPool.
+struct Particle {
+  float x;
+};
+
+namespace entityx {
+template <>
+struct PoolTraits<Particle> {
+  typedef ContiguousPool<Particle> PoolType;
+};
+}  // namespace entityx
+
+// Packed components, for owning groups.
+struct Transform {
+  explicit Transform(float x = 0.0f) : x(x) {}
+
+  float x;
+};
+
+struct Velocity {
+  explicit Velocity(float x = 0.0f) : x(x) {}
+
+  float x;
+};
+
+namespace entityx {
+template <>
+struct PoolTraits<Transform> {
+  typedef PackedPool<Transform> PoolType;
+};
+
+template <>
+struct PoolTraits<Velocity> {
+  typedef PackedPool<Velocity> PoolType;
+};
+}  // namespace entityx
+
+// A component with change tracking.
+struct Health {
+  explicit Health(int value = 0) : value(value) {}
+
+  int value;
+};
+
+namespace entityx {
+template <>
+struct TrackChanges<Health> : std::true_type {};
+}  // namespace entityx
+
 struct Tag : Component<Tag> {
   explicit Tag(string tag) : tag(tag) {}
 
@@ -293,6 +342,8 @@ TEST_CASE_METHOD(EntityManagerFixture, "TestComponentIdsDiffer") {
   REQUIRE(Component<Position>::family() !=  Component<Direction>::family());
 }
 
+// Lifecycle events can be compiled out, see ENTITYX_LIFECYCLE_EVENTS.
+#if ENTITYX_LIFECYCLE_EVENTS
 TEST_CASE_METHOD(EntityManagerFixture, "TestEntityCreatedEvent") {
   struct EntityCreatedEventReceiver
       : public Receiver<EntityCreatedEventReceiver> {
@@ -404,6 +455,31 @@ TEST_CASE_METHOD(EntityManagerFixture, "TestComponentRemovedEvent") {
   REQUIRE(receiver.removed ==  p);
   REQUIRE(!(e.component<Direction>()));
 }
+#else
+TEST_CASE_METHOD(EntityManagerFixture, "TestLifecycleEventsDisabled") {
+  struct LifecycleReceiver : public Receiver<LifecycleReceiver> {
+    void receive(const EntityCreatedEvent &event) { events++; }
+    void receive(const EntityDestroyedEvent &event) { events++; }
+    void receive(const ComponentAddedEvent<Position> &event) { events++; }
+    void receive(const ComponentRemovedEvent<Position> &event) { events++; }
+
+    int events = 0;
+  };
+
+  LifecycleReceiver receiver;
+  ev.subscribe<EntityCreatedEvent>(receiver);
+  ev.subscribe<EntityDestroyedEvent>(receiver);
+  ev.subscribe<ComponentAddedEvent<Position>>(receiver);
+  ev.subscribe<ComponentRemovedEvent<Position>>(receiver);
+
+  Entity e = em.create();
+  e.assign<Position>(1.0f, 2.0f);
+  e.remove<Position>();
+  e.assign<Position>();
+  e.destroy();
+  REQUIRE(0 == receiver.events);
+}
+#endif
 
 TEST_CASE_METHOD(EntityManagerFixture, "TestEntityAssignment") {
   Entity a, b;
@@ -592,3 +668,707 @@ TEST_CASE_METHOD(EntityManagerFixture, "TestComponentsRemovedFromReusedEntities"
   REQUIRE(!b.has_component<Position>());
   b.assign<Position>(3, 4);
 }
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestContiguousPoolComponents") {
+  vector<Entity> entities;
+  for (int i = 0; i < 100; i++) {
+    Entity e = em.create();
+    e.assign<Position>(static_cast<float>(i));
+    if (i % 2 == 0) e.assign<Particle>(Particle{static_cast<float>(i)});
+    entities.push_back(e);
+  }
+  // Handles survive the pool growing.
+  ComponentHandle<Particle> first = entities[0].component<Particle>();
+  for (int i = 0; i < 1000; i++) em.create().assign<Particle>(Particle{-1.0f});
+  REQUIRE(0.0f == first->x);
+
+  entities[2].remove<Particle>();
+  entities[4].destroy();
+  REQUIRE(48 == size(em.entities_with_components<Position, Particle>()));
+  ComponentHandle<Position> position;
+  ComponentHandle<Particle> particle;
+  for (Entity e : em.entities_with_components(position, particle)) {
+    (void)e;
+    REQUIRE(position->x == particle->x);
+  }
+
+  em.sort<Particle>([](const Particle &a, const Particle &b) { return a.x > b.x; });
+  float last = 1000.0f;
+  for (Entity e : em.entities_with_components(particle)) {
+    (void)e;
+    REQUIRE(particle->x <= last);
+    last = particle->x;
+  }
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestSortEntitiesByComponent") {
+  const float xs[] = {5, 3, 9, 1, 7};
+  for (float x : xs) {
+    Entity e = em.create();
+    e.assign<Position>(x, 0);
+    e.assign<Direction>(-x, 0);
+  }
+  Entity bystander = em.create();
+  bystander.assign<Direction>(42, 0);
+
+  struct Relocations : public Receiver<Relocations> {
+    void receive(const EntitiesRelocatedEvent &event) {
+      for (auto &ids : event.ids) moved[ids.first] = ids.second;
+      events.push_back(event);
+    }
+
+    map<Entity::Id, Entity::Id> moved;
+    vector<EntitiesRelocatedEvent> events;
+  };
+  Relocations relocations;
+  ev.subscribe<EntitiesRelocatedEvent>(relocations);
+
+  Entity first = *em.entities_with_components<Position>().begin();
+  em.sort<Position>([](const Position &a, const Position &b) { return a.x < b.x; });
+  REQUIRE(!first.valid());
+  REQUIRE(bystander.valid());
+  REQUIRE(bystander.component<Direction>()->x == 42);
+  // Every entity other than 3, which stays put, is relocated.
+  REQUIRE(4 == relocations.moved.size());
+  // Events can be kept after delivery.
+  REQUIRE(4 == relocations.events.at(0).ids.size());
+  REQUIRE(relocations.moved.count(first.id()));
+  Entity moved = em.get(relocations.moved[first.id()]);
+  REQUIRE(moved.component<Position>()->x == 5);
+
+  vector<float> sorted;
+  ComponentHandle<Position> position;
+  ComponentHandle<Direction> direction;
+  for (Entity e : em.entities_with_components(position, direction)) {
+    (void)e;
+    REQUIRE(direction->x == -position->x);
+    sorted.push_back(position->x);
+  }
+  REQUIRE(sorted == vector<float>({1, 3, 5, 7, 9}));
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestSortEntitiesByKey") {
+  vector<Entity> entities;
+  for (int i = 0; i < 100; i++) {
+    Entity e = em.create();
+    e.assign<Position>(static_cast<float>((i * 37) % 100));
+    if (i % 3 == 0) e.assign<Tag>("tag");
+    entities.push_back(e);
+  }
+  entities[50].destroy();
+
+  em.sort_by<Position>([](const Position &p) { return -p.x; });
+
+  float last = 100;
+  int tags = 0;
+  ComponentHandle<Position> position;
+  for (Entity e : em.entities_with_components(position)) {
+    REQUIRE(position->x < last);
+    last = position->x;
+    if (e.has_component<Tag>()) tags++;
+  }
+  REQUIRE(99 == size(em.entities_with_components<Position>()));
+  REQUIRE(34 == tags);
+}
+
+struct Enemy : Component<Enemy> {};
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestEmptyComponentsAreTags") {
+  Entity a = em.create();
+  Entity b = em.create();
+  a.assign<Position>(1, 2);
+  b.assign<Position>(3, 4);
+  ComponentHandle<Enemy> enemy = b.assign<Enemy>();
+
+  REQUIRE(enemy);
+  REQUIRE(!a.has_component<Enemy>());
+  REQUIRE(b.has_component<Enemy>());
+  REQUIRE(enemy == b.component<Enemy>());
+  REQUIRE(1 == size(em.entities_with_components<Enemy>()));
+  REQUIRE(1 == size(em.entities_with_components<Position, Enemy>()));
+
+  ComponentHandle<Position> position;
+  ComponentHandle<Enemy> tag;
+  for (Entity e : em.entities_with_components(position, tag)) {
+    REQUIRE(e == b);
+    REQUIRE(tag);
+    REQUIRE(position->x == 3);
+  }
+
+  b.remove<Enemy>();
+  REQUIRE(!enemy);
+  REQUIRE(0 == size(em.entities_with_components<Enemy>()));
+
+  a.assign<Enemy>();
+  em.sort<Position>([](const Position &l, const Position &r) { return l.x > r.x; });
+  REQUIRE(1 == size(em.entities_with_components<Enemy>()));
+  for (Entity e : em.entities_with_components(position, tag)) {
+    REQUIRE(position->x == 1);
+    e.destroy();
+  }
+  REQUIRE(0 == size(em.entities_with_components<Enemy>()));
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestAssignTagFromCopy") {
+  Entity a = em.create();
+  Entity b = em.create();
+  Entity c = em.create();
+  Enemy enemy;
+  REQUIRE(a.assign_from_copy(enemy));
+  REQUIRE(b.assign<Enemy>(Enemy()));
+  REQUIRE(c.assign<Enemy>(enemy));
+  REQUIRE(3 == size(em.entities_with_components<Enemy>()));
+}
+
+struct Counted : Component<Counted> {
+  explicit Counted(int increment = 1) { live += increment; }
+  ~Counted() { live--; }
+
+  static int live;
+};
+
+int Counted::live = 0;
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestNonTrivialEmptyComponentsAreConstructed") {
+  REQUIRE(IsTag<Enemy>::value);
+  REQUIRE(!IsTag<Counted>::value);
+
+  Entity a = em.create();
+  Entity b = em.create();
+  a.assign<Counted>();
+  b.assign<Counted>(2);
+  REQUIRE(3 == Counted::live);
+  REQUIRE(a.component<Counted>().get() != b.component<Counted>().get());
+
+  a.remove<Counted>();
+  REQUIRE(2 == Counted::live);
+  b.destroy();
+  REQUIRE(1 == Counted::live);
+  Counted::live = 0;
+}
+
+struct IsVisible {};
+struct IsDirty {};
+
+namespace entityx {
+template <>
+struct PoolTraits<IsVisible> {
+  typedef FlagPool PoolType;
+};
+template <>
+struct PoolTraits<IsDirty> {
+  typedef FlagPool PoolType;
+};
+}  // namespace entityx
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestFlagComponents") {
+  REQUIRE(IsFlag<IsVisible>::value);
+  REQUIRE(!IsFlag<Enemy>::value);
+  REQUIRE(0 == em.entities_with_flags<IsVisible>().size());
+
+  vector<Entity> entities;
+  for (int i = 0; i < 200; i++) {
+    Entity e = em.create();
+    e.assign<Position>(static_cast<float>(i));
+    e.set_flag<IsVisible>(i % 2 == 0);
+    if (i % 3 == 0) e.assign<IsDirty>();
+    entities.push_back(e);
+  }
+
+  REQUIRE(100 == em.entities_with_flags<IsVisible>().size());
+  REQUIRE(100 == size(em.entities_with_flags<IsVisible>()));
+  REQUIRE(100 == size(em.entities_with_components<IsVisible>()));
+  REQUIRE(34 == (em.entities_with_flags<IsDirty, IsVisible>().size()));
+  for (Entity e : em.entities_with_flags<IsVisible, IsDirty>()) {
+    int x = static_cast<int>(e.component<Position>()->x);
+    REQUIRE(0 == x % 6);
+  }
+
+  entities[0].set_flag<IsVisible>(false);
+  entities[1].set_flag<IsVisible>(true);
+  REQUIRE(!entities[0].has_component<IsVisible>());
+  REQUIRE(entities[1].has_component<IsVisible>());
+  entities[3].remove<IsDirty>();
+  entities[2].destroy();
+  REQUIRE(99 == em.entities_with_flags<IsVisible>().size());
+  REQUIRE(33 == (em.entities_with_flags<IsDirty, IsVisible>().size()));
+
+  em.sort<Position>([](const Position &a, const Position &b) { return a.x > b.x; });
+  REQUIRE(99 == em.entities_with_flags<IsVisible>().size());
+  for (Entity e : em.entities_with_flags<IsVisible>()) {
+    int x = static_cast<int>(e.component<Position>()->x);
+    REQUIRE((x == 1 || x % 2 == 0));
+  }
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestExcludeAndOptionalComponents") {
+  for (int i = 0; i < 12; i++) {
+    Entity e = em.create();
+    e.assign<Position>(static_cast<float>(i));
+    if (i % 2 == 0) e.assign<Direction>(static_cast<float>(i));
+    if (i % 3 == 0) e.assign<Enemy>();
+  }
+
+  REQUIRE(8 == size(em.entities_with_components<Position>().exclude<Enemy>()));
+  REQUIRE(6 == size(em.entities_with_components<Position>().exclude<Direction>()));
+  REQUIRE(4 == size(em.entities_with_components<Position>().exclude<Enemy, Direction>()));
+
+  ComponentHandle<Position> position;
+  ComponentHandle<Direction> direction;
+  int visited = 0;
+  for (Entity e : em.entities_with_components(position, direction).exclude<Enemy>()) {
+    REQUIRE(!e.has_component<Enemy>());
+    REQUIRE(position->x == direction->x);
+    visited++;
+  }
+  REQUIRE(4 == visited);
+
+  visited = 0;
+  int with_direction = 0;
+  for (Entity e : em.entities_with_components(position, direction).optional<Direction>().exclude<Enemy>()) {
+    REQUIRE(!e.has_component<Enemy>());
+    REQUIRE(static_cast<bool>(direction) == e.has_component<Direction>());
+    if (direction) {
+      REQUIRE(position->x == direction->x);
+      with_direction++;
+    }
+    visited++;
+  }
+  REQUIRE(8 == visited);
+  REQUIRE(4 == with_direction);
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestGroupsTrackComponentChanges") {
+  std::vector<Entity> entities;
+  for (int i = 0; i < 10; i++) {
+    Entity e = em.create();
+    e.assign<Position>(static_cast<float>(i));
+    if (i % 2 == 0) e.assign<Direction>(static_cast<float>(i));
+    entities.push_back(e);
+  }
+
+  EntityManager::Group &group = em.group<Position, Direction>();
+  REQUIRE((&group == &em.group<Position, Direction>()));
+  REQUIRE(5 == group.size());
+  // Existing members are visited in index order.
+  float last = -1;
+  for (Entity e : group) {
+    REQUIRE(e.component<Position>()->x > last);
+    last = e.component<Position>()->x;
+  }
+
+  entities[1].assign<Direction>(1.0f);
+  entities[0].remove<Direction>();
+  entities[2].destroy();
+  Entity e = em.create();
+  e.assign<Direction>(20.0f);
+  REQUIRE(4 == group.size());
+  e.assign<Position>(20.0f);
+  REQUIRE(5 == group.size());
+  for (Entity member : group) {
+    REQUIRE(member.has_component<Position>());
+    REQUIRE(member.has_component<Direction>());
+  }
+
+  // Removing the current entity while iterating is safe.
+  int visited = 0;
+  for (Entity member : group) {
+    member.remove<Position>();
+    visited++;
+  }
+  REQUIRE(5 == visited);
+  REQUIRE(0 == group.size());
+  REQUIRE(5 == size(em.entities_with_components<Direction>()));
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestOwningGroupsPackComponents") {
+  std::vector<Entity> entities;
+  for (int i = 0; i < 20; i++) {
+    Entity e = em.create();
+    if (i % 2 == 0) e.assign<Transform>(static_cast<float>(i));
+    if (i % 3 == 0) e.assign<Velocity>(static_cast<float>(i));
+    entities.push_back(e);
+  }
+
+  auto check_packed = [](EntityManager::Group &group) {
+    Transform *transform = group.data<Transform>();
+    Velocity *velocity = group.data<Velocity>();
+    int i = 0;
+    for (Entity e : group) {
+      (void)e;
+      ++i;
+    }
+    REQUIRE(i == static_cast<int>(group.size()));
+    for (size_t i = 0; i < group.size(); i++) REQUIRE(transform[i].x == velocity[i].x);
+  };
+
+  EntityManager::Group &group = em.owning_group<Transform, Velocity>();
+  REQUIRE(4 == group.size());
+  check_packed(group);
+  REQUIRE((&group == &em.group<Transform, Velocity>()));
+
+  entities[3].assign<Transform>(3.0f);
+  entities[0].remove<Velocity>();
+  entities[6].destroy();
+  entities[7].assign<Transform>(7.0f);
+  entities[7].assign<Velocity>(7.0f);
+  REQUIRE(4 == group.size());
+  check_packed(group);
+  // Sorting relabels packed components, and rebuilds the group.
+  em.sort_by<Transform>([](const Transform &transform) { return -transform.x; });
+  REQUIRE(4 == group.size());
+  check_packed(group);
+  for (Entity e : group) {
+    REQUIRE(e.component<Transform>()->x == e.component<Velocity>()->x);
+    e.remove<Transform>();
+  }
+  REQUIRE(0 == group.size());
+  REQUIRE(6 == size(em.entities_with_components<Velocity>()));
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestChangedSince") {
+  std::vector<Entity> entities;
+  for (int i = 0; i < 200; i++) {
+    Entity e = em.create();
+    e.assign<Health>(100);
+    if (i % 2) e.assign<Position>();
+    entities.push_back(e);
+  }
+  REQUIRE(200 == size(em.entities_with_components<Health>().changed_since<Health>(0)));
+
+  uint64_t tick = em.tick();
+  REQUIRE(0 == size(em.entities_with_components<Health>().changed_since<Health>(tick)));
+
+  entities[3].component<Health>()->value -= 10;
+  entities[150].mark_changed<Health>();
+  const Entity &constant = entities[180];
+  REQUIRE(100 == constant.component<Health>()->value);
+  std::vector<Entity> changed;
+  for (Entity e : em.entities_with_components<Health>().changed_since<Health>(tick)) changed.push_back(e);
+  REQUIRE(2 == changed.size());
+  REQUIRE(entities[3] == changed[0]);
+  REQUIRE(entities[150] == changed[1]);
+
+  ComponentHandle<Health> health;
+  ComponentHandle<Position> position;
+  REQUIRE(1 == size(em.entities_with_components(health, position).changed_since<Health>(tick)));
+
+  // Reading through mutable handles marks components as changed too.
+  tick = em.tick();
+  for (Entity e : em.entities_with_components(health, position)) {
+    (void)e;
+    REQUIRE(health->value <= 100);
+  }
+  REQUIRE(100 == size(em.entities_with_components<Health>().changed_since<Health>(tick)));
+
+  // Replacing a component marks it as changed once.
+  tick = em.tick();
+  entities[0].replace<Health>(50);
+  REQUIRE((tick + 1 == em.tick()));
+  REQUIRE(50 == entities[0].component<const Health>()->value);
+
+  // Entities that changed and then lost the component are not visited.
+  tick = em.tick();
+  entities[1].mark_changed<Health>();
+  entities[1].remove<Health>();
+  REQUIRE(0 == size(em.entities_with_components<Position>().changed_since<Health>(tick)));
+  REQUIRE(0 == size(em.entities_with_components(health, position).changed_since<Health>(tick)));
+
+  // Nor are new entities reusing the slot of an entity that changed.
+  tick = em.tick();
+  entities[5].mark_changed<Health>();
+  const uint32_t slot = entities[5].id().index();
+  entities[5].destroy();
+  Entity reused = em.create();
+  REQUIRE(slot == reused.id().index());
+  reused.assign<Position>();
+  REQUIRE(0 == size(em.entities_with_components<Position>().changed_since<Health>(tick)));
+  REQUIRE(0 == size(em.entities_with_components(health, position).changed_since<Health>(tick)));
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestObservers") {
+  EntityManager::Observer &added = em.observe_added<Position, Direction>();
+  EntityManager::Observer &removed = em.observe_removed<Position>();
+  EntityManager::Observer &changed = em.observe_changed<Health>();
+  REQUIRE((&added == &em.observe_added<Position, Direction>()));
+
+  Entity a = em.create();
+  Entity b = em.create();
+  Entity c = em.create();
+  a.assign<Position>();
+  a.assign<Direction>();
+  b.assign<Position>();
+  b.assign<Direction>();
+  c.assign<Position>();
+  c.assign<Health>(10);
+  REQUIRE(2 == added.size());
+  REQUIRE(0 == removed.size());
+  REQUIRE(1 == changed.size());
+
+  // Entities that stop matching are dropped, others appear once.
+  b.remove<Direction>();
+  a.remove<Direction>();
+  a.assign<Direction>();
+  REQUIRE(1 == added.size());
+  REQUIRE(a == *added.begin());
+
+  c.component<Health>()->value++;
+  REQUIRE(1 == changed.size());
+  c.destroy();
+  REQUIRE(0 == changed.size());
+  REQUIRE(1 == removed.size());
+  REQUIRE(!(*removed.begin()).valid());
+
+  b.remove<Position>();
+  REQUIRE(2 == removed.size());
+  added.clear();
+  removed.clear();
+  REQUIRE(added.empty());
+  REQUIRE(removed.empty());
+
+  // Recorded entities follow their components when sorted.
+  changed.clear();
+  for (int i = 0; i < 5; i++) em.create().assign<Health>(10 - i);
+  em.sort_by<Health>([](const Health &health) { return health.value; });
+  REQUIRE(5 == changed.size());
+  for (Entity e : changed) REQUIRE(e.valid());
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestComponentHooks") {
+  struct Calls {
+    int constructed = 0, destroyed = 0, updated = 0;
+
+    static void construct(void *context, Entity entity) {
+      REQUIRE(entity.has_component<Position>());
+      static_cast<Calls*>(context)->constructed++;
+    }
+    static void destroy(void *context, Entity entity) {
+      REQUIRE(entity.has_component<Position>());
+      static_cast<Calls*>(context)->destroyed++;
+    }
+    static void update(void *context, Entity entity) { static_cast<Calls*>(context)->updated++; }
+  };
+  Calls calls, other;
+  em.on_construct<Position>(&Calls::construct, &calls);
+  em.on_destroy<Position>(&Calls::destroy, &calls);
+  em.on_update<Position>(&Calls::update, &calls);
+  em.on_construct<Position>(&Calls::construct, &other);
+
+  Entity a = em.create();
+  Entity b = em.create();
+  a.assign<Position>();
+  b.assign<Position>();
+  b.assign<Direction>();
+  REQUIRE(2 == calls.constructed);
+  REQUIRE(2 == other.constructed);
+
+  a.replace<Position>(1.0f, 2.0f);
+  b.mark_changed<Position>();
+  REQUIRE(2 == calls.updated);
+
+  a.remove<Position>();
+  b.destroy();
+  REQUIRE(2 == calls.destroyed);
+
+  em.remove_hooks<Position>(&calls);
+  em.create().assign<Position>();
+  REQUIRE(2 == calls.constructed);
+  REQUIRE(3 == other.constructed);
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestAssignMany") {
+  struct Batches : public Receiver<Batches> {
+    void receive(const ComponentsAddedEvent<Position> &event) {
+      batches++;
+      size += event.ids.size();
+      for (Entity::Id id : event.ids) REQUIRE(event.manager->has_component<Position>(id));
+    }
+    void receive(const ComponentAddedEvent<Position> &event) { singles++; }
+
+    int batches = 0, singles = 0;
+    size_t size = 0;
+  };
+  struct Calls {
+    int constructed = 0, batches = 0;
+
+    static void construct(void *context, Entity entity) { static_cast<Calls*>(context)->constructed++; }
+    static void construct_many(void *context, EntityManager &manager, const std::vector<Entity::Id> &ids) {
+      static_cast<Calls*>(context)->batches++;
+    }
+  };
+
+  Batches batches;
+  ev.subscribe<ComponentsAddedEvent<Position>>(batches);
+  Calls single, batched;
+  em.on_construct<Position>(&Calls::construct, &single);
+  em.on_construct<Position>(&Calls::construct, &Calls::construct_many, &batched);
+  auto &group = em.group<Position>();
+
+  std::vector<Entity::Id> ids;
+  for (int i = 0; i < 10; i++) ids.push_back(em.create().id());
+  em.assign_many<Position>(ids, 1.0f, 2.0f);
+  for (Entity::Id id : ids) REQUIRE(*em.component<Position>(id).get() == Position(1.0f, 2.0f));
+  REQUIRE(10 == group.size());
+  if (LIFECYCLE_EVENTS) {
+    REQUIRE(1 == batches.batches);
+    REQUIRE(10 == batches.size);
+  }
+  REQUIRE(10 == single.constructed);
+  REQUIRE(0 == batched.constructed);
+  REQUIRE(1 == batched.batches);
+
+  // Per-entity events are emitted too, if anything receives them.
+  ev.subscribe<ComponentAddedEvent<Position>>(batches);
+  std::vector<Entity::Id> more = {em.create().id(), em.create().id()};
+  em.assign_many<Position>(more);
+  if (LIFECYCLE_EVENTS) {
+    REQUIRE(2 == batches.singles);
+    REQUIRE(2 == batches.batches);
+  }
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestQueuedComponentsAddedEventOutlivesAssignMany") {
+  struct Forwarder : public Receiver<Forwarder> {
+    explicit Forwarder(EventManager &queue) : queue(queue) {}
+    void receive(const ComponentsAddedEvent<Position> &event) { queue.enqueue(event); }
+
+    EventManager &queue;
+  };
+  struct Reader : public Receiver<Reader> {
+    void receive(const ComponentsAddedEvent<Position> &event) { ids = event.ids; }
+
+    std::vector<Entity::Id> ids;
+  };
+
+  EventManager queue;
+  Forwarder forwarder(queue);
+  Reader reader;
+  ev.subscribe<ComponentsAddedEvent<Position>>(forwarder);
+  queue.subscribe<ComponentsAddedEvent<Position>>(reader);
+
+  std::vector<Entity::Id> expected;
+  {
+    std::vector<Entity::Id> ids = {em.create().id(), em.create().id(), em.create().id()};
+    expected = ids;
+    em.assign_many<Position>(ids);
+    // Overwrite the argument before it goes out of scope.
+    std::fill(ids.begin(), ids.end(), Entity::INVALID);
+  }
+  queue.update<ComponentsAddedEvent<Position>>();
+  if (LIFECYCLE_EVENTS) {
+    REQUIRE(expected == reader.ids);
+  } else {
+    REQUIRE(reader.ids.empty());
+  }
+}
+
+struct Shape {
+  int sides = 4;
+};
+struct Collider {};
+struct RigidBody {
+  float mass = 1.0f;
+};
+
+namespace entityx {
+template <>
+struct Requires<Collider> : ComponentList<Position, Shape> {};
+template <>
+struct Requires<RigidBody> : ComponentList<Collider, Position, Velocity> {};
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestRequiredComponents") {
+  struct Added : public Receiver<Added> {
+    void receive(const ComponentAddedEvent<Position> &event) { positions++; }
+    void receive(const ComponentAddedEvent<Shape> &event) { shapes++; }
+    void receive(const ComponentAddedEvent<RigidBody> &event) {
+      // Requirements are notified before their dependents.
+      REQUIRE(1 == positions);
+      REQUIRE(1 == shapes);
+      bodies++;
+    }
+
+    int positions = 0, shapes = 0, bodies = 0;
+  };
+  Added added;
+  ev.subscribe<ComponentAddedEvent<Position>>(added);
+  ev.subscribe<ComponentAddedEvent<Shape>>(added);
+  ev.subscribe<ComponentAddedEvent<RigidBody>>(added);
+  auto &group = em.group<RigidBody, Shape, Velocity>();
+
+  Entity a = em.create();
+  a.assign<Velocity>(2.0f);
+  a.assign<RigidBody>();
+  REQUIRE(a.has_component<Collider>());
+  REQUIRE(a.has_component<Position>());
+  REQUIRE(4 == a.component<Shape>()->sides);
+  // Existing components are left alone.
+  REQUIRE(2.0f == a.component<Velocity>()->x);
+  if (LIFECYCLE_EVENTS) {
+    REQUIRE(1 == added.positions);
+    REQUIRE(1 == added.bodies);
+  }
+  REQUIRE(1 == group.size());
+
+  // Removing a requirement removes its dependents, transitively.
+  a.remove<Shape>();
+  REQUIRE(!a.has_component<Collider>());
+  REQUIRE(!a.has_component<RigidBody>());
+  REQUIRE(a.has_component<Position>());
+  REQUIRE(a.has_component<Velocity>());
+  REQUIRE(0 == group.size());
+
+  std::vector<Entity::Id> ids = {em.create().id(), em.create().id()};
+  em.assign_many<Collider>(ids);
+  for (Entity::Id id : ids) REQUIRE(em.has_component<Shape>(id));
+  if (LIFECYCLE_EVENTS) REQUIRE(3 == added.shapes);
+}
+
+struct IsGrounded {};
+struct Walker {
+  int legs = 2;
+};
+
+namespace entityx {
+template <>
+struct PoolTraits<IsGrounded> {
+  typedef FlagPool PoolType;
+};
+template <>
+struct Requires<IsGrounded> : ComponentList<Position> {};
+template <>
+struct Requires<Walker> : ComponentList<IsGrounded> {};
+}
+
+TEST_CASE_METHOD(EntityManagerFixture, "TestRequiredFlags") {
+  struct Calls {
+    int constructed = 0, destroyed = 0;
+
+    static void construct(void *context, Entity entity) { static_cast<Calls*>(context)->constructed++; }
+    static void destroy(void *context, Entity entity) { static_cast<Calls*>(context)->destroyed++; }
+  };
+  Calls calls;
+  em.on_construct<IsGrounded>(&Calls::construct, &calls);
+  em.on_destroy<IsGrounded>(&Calls::destroy, &calls);
+
+  // Setting a flag constructs its requirements.
+  Entity a = em.create();
+  a.set_flag<IsGrounded>(true);
+  REQUIRE(a.has_component<Position>());
+  REQUIRE(1 == em.entities_with_flags<IsGrounded>().size());
+  REQUIRE(1 == calls.constructed);
+
+  // Clearing a flag removes the components requiring it.
+  a.assign<Walker>();
+  a.set_flag<IsGrounded>(false);
+  REQUIRE(!a.has_component<Walker>());
+  REQUIRE(a.has_component<Position>());
+  REQUIRE(0 == em.entities_with_flags<IsGrounded>().size());
+  REQUIRE(1 == calls.destroyed);
+
+  // Assigning a dependent sets the flag, through its hooks.
+  Entity b = em.create();
+  b.assign<Walker>();
+  REQUIRE(b.has_component<IsGrounded>());
+  REQUIRE(2 == calls.constructed);
+}
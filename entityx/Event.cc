@@ -8,19 +8,483 @@
  * Author: Alec Thomas <alec@swapoff.org>
  */
 
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
 #include "entityx/Event.h"
 
 namespace entityx {
 
-BaseEvent::Family BaseEvent::family_counter_ = 0;
+std::atomic<BaseEvent::Family> BaseEvent::family_counter_(0);
 
 BaseEvent::~BaseEvent() {
 }
 
-EventManager::EventManager() {
+BaseReceiver::~BaseReceiver() {
+  for (auto &connection : connections_) {
+    EventSignalPtr signal = connection.signal.lock();
+    if (!signal) continue;
+    signal->disconnect(connection.id);
+    if (connection.targeted) connection.manager->release_target(connection.family, connection.target);
+  }
+}
+
+namespace {
+
+// Epochs of post buffers, unique across EventManagers.
+std::atomic<std::uint64_t> post_epochs(0);
+
+// The post buffer last used by this thread, valid while its epoch is current.
+struct PostBufferCache {
+  std::uint64_t epoch;
+  void *buffer;
+};
+
+thread_local PostBufferCache post_buffer_cache = {0, nullptr};
+
+std::string demangle(const char *name) {
+#if defined(__GNUG__)
+  int status = 0;
+  char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (demangled) {
+    std::string result(demangled);
+    std::free(demangled);
+    return result;
+  }
+#endif
+  return name;
+}
+
+void write_string(std::ostream &out, const std::string &str) {
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') out << '\\';
+    out << c;
+  }
+  out << '"';
+}
+
+}  // namespace
+
+const std::size_t EventStats::BUCKETS;
+
+std::uint64_t EventStats::percentile(double p) const {
+  std::uint64_t total = 0;
+  for (std::uint64_t count : histogram) total += count;
+  if (!total) return 0;
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen >= p * total) return std::uint64_t(1) << (i + 1);
+  }
+  return std::uint64_t(1) << BUCKETS;
+}
+
+const std::uint32_t EventSignal::PENDING;
+
+std::uint64_t EventSignal::connect(Delegate delegate, int priority) {
+  std::uint32_t handle;
+  if (free_handles_.empty()) {
+    handle = std::uint32_t(handles_.size());
+    handles_.push_back(Handle{PENDING, 0});
+  } else {
+    handle = free_handles_.back();
+    free_handles_.pop_back();
+  }
+  Slot slot = {delegate, handle, priority};
+  if (emitting_) {
+    handles_[handle].position = PENDING;
+    connecting_.push_back(slot);
+  } else {
+    insert(slot);
+  }
+  connected_++;
+  return (std::uint64_t(handles_[handle].generation) << 32) | handle;
+}
+
+void EventSignal::disconnect(std::uint64_t connection) {
+  std::uint32_t index = std::uint32_t(connection), generation = std::uint32_t(connection >> 32);
+  if (index >= handles_.size() || handles_[index].generation != generation) return;
+  Handle &handle = handles_[index];
+  if (handle.position == PENDING) {
+    for (std::size_t i = 0; i < connecting_.size(); i++) {
+      if (connecting_[i].handle != index) continue;
+      connecting_.erase(connecting_.begin() + i);
+      break;
+    }
+  } else {
+    // Leave a hole, so that indices being iterated over remain valid.
+    slots_[handle.position].delegate.receiver = nullptr;
+    holes_++;
+  }
+  handle.generation++;
+  free_handles_.push_back(index);
+  connected_--;
+  if (!emitting_ && holes_ * 2 > slots_.size()) flush();
+}
+
+void EventSignal::insert(const Slot &slot) {
+  // After any slots of the same priority.
+  auto it = std::upper_bound(slots_.begin(), slots_.end(), slot.priority,
+                             [](int priority, const Slot &other) { return priority > other.priority; });
+  std::size_t position = it - slots_.begin();
+  slots_.insert(it, slot);
+  // Usually just the new slot, as most receivers share a priority. Holes'
+  // handles may already have been reused, so are skipped.
+  for (std::size_t i = position; i < slots_.size(); i++) {
+    if (slots_[i].delegate.receiver) handles_[slots_[i].handle].position = std::uint32_t(i);
+  }
+}
+
+void EventSignal::flush() {
+  if (holes_ * 2 > slots_.size()) {
+    std::size_t live = 0;
+    for (std::size_t i = 0; i < slots_.size(); i++) {
+      if (!slots_[i].delegate.receiver) continue;
+      slots_[live] = slots_[i];
+      handles_[slots_[live].handle].position = std::uint32_t(live);
+      live++;
+    }
+    slots_.resize(live);
+    holes_ = 0;
+  }
+  for (const Slot &slot : connecting_) insert(slot);
+  connecting_.clear();
+}
+
+EventManager::EventManager() : post_epoch_(++post_epochs) {
 }
 
 EventManager::~EventManager() {
+  for (BaseQueue *queue : queues_) delete queue;
+  for (PostBuffer *buffer : post_buffers_) delete buffer;
+  for (PostBuffer *buffer : spare_post_buffers_) delete buffer;
+  for (BaseEventStream *stream : streams_) delete stream;
+}
+
+void EventManager::connect(BaseReceiver &receiver, std::size_t family, bool targeted, std::uint64_t target,
+                           Delegate delegate, int priority) {
+  EventSignalPtr *sig;
+  if (targeted) {
+    if (family >= targets_.size())
+      targets_.resize(family + 1);
+    sig = &targets_[family][target];
+    if (!*sig)
+      *sig = std::make_shared<EventSignal>();
+  } else {
+    sig = &signal_for(family);
+  }
+  std::uint64_t id = (*sig)->connect(delegate, priority);
+  BaseReceiver::Connection connection = {family, targeted, target, EventSignalWeakPtr(*sig), id, this};
+  receiver.connections_.push_back(connection);
+}
+
+bool EventManager::disconnect(BaseReceiver &receiver, std::size_t family, bool targeted, std::uint64_t target) {
+  auto &connections = receiver.connections_;
+  bool found = false;
+  for (std::size_t i = 0; i < connections.size();) {
+    BaseReceiver::Connection &connection = connections[i];
+    if (connection.family != family || connection.targeted != targeted || connection.target != target) {
+      i++;
+      continue;
+    }
+    if (!connection.signal.expired()) {
+      connection.signal.lock()->disconnect(connection.id);
+      if (targeted) release_target(family, target);
+    }
+    connections.swap_erase(i);
+    found = true;
+  }
+  return found;
+}
+
+EventSignal *EventManager::target_signal(std::size_t family, std::uint64_t target) {
+  if (family >= targets_.size()) return nullptr;
+  auto &signals = targets_[family];
+  auto it = signals.find(target);
+  if (it == signals.end()) return nullptr;
+  EventSignal *signal = it->second.get();
+  return signal->empty() ? nullptr : signal;
+}
+
+void EventManager::release_target(std::size_t family, std::uint64_t target) {
+  auto &signals = targets_[family];
+  auto it = signals.find(target);
+  // Receivers hold only weak references, so erasing is safe unless the
+  // signal is being emitted, in which case emit_to() releases it.
+  if (it != signals.end() && it->second->empty() && !it->second->emitting()) signals.erase(it);
+}
+
+void EventManager::update_all() {
+  if (posting_) merge_posted();
+  // By index, as receivers may queue events of new types.
+  for (std::size_t i = 0; i < queues_.size(); i++) {
+    if (queues_[i]) queues_[i]->deliver(*this);
+  }
+}
+
+EventManager::PostBuffer &EventManager::post_buffer() {
+  if (post_buffer_cache.buffer && post_buffer_cache.epoch == post_epoch_)
+    return *static_cast<PostBuffer*>(post_buffer_cache.buffer);
+  std::lock_guard<std::mutex> lock(posted_mutex_);
+  // The thread may have posted to another EventManager in between.
+  const std::thread::id thread = std::this_thread::get_id();
+  PostBuffer *buffer = nullptr;
+  for (PostBuffer *candidate : post_buffers_) {
+    if (candidate->thread == thread) buffer = candidate;
+  }
+  if (!buffer) {
+    if (spare_post_buffers_.empty()) {
+      buffer = new PostBuffer();
+    } else {
+      buffer = spare_post_buffers_.back();
+      spare_post_buffers_.pop_back();
+    }
+    buffer->thread = thread;
+    post_buffers_.push_back(buffer);
+    posting_ = true;
+  }
+  post_buffer_cache.epoch = post_epoch_;
+  post_buffer_cache.buffer = buffer;
+  return *buffer;
+}
+
+void EventManager::merge_posted(std::size_t family) {
+  std::lock_guard<std::mutex> lock(posted_mutex_);
+  merge_posted_locked(family);
+}
+
+void EventManager::merge_posted() {
+  std::lock_guard<std::mutex> lock(posted_mutex_);
+  std::size_t families = 0;
+  for (PostBuffer *buffer : post_buffers_) families = std::max(families, buffer->posted.size());
+  for (std::size_t family = 0; family < families; family++) merge_posted_locked(family);
+  // Every buffer is now empty, so recycle them. Threads pick up a buffer
+  // again on their next post.
+  spare_post_buffers_.insert(spare_post_buffers_.end(), post_buffers_.begin(), post_buffers_.end());
+  post_buffers_.clear();
+  post_epoch_ = ++post_epochs;
+  posting_ = false;
+}
+
+void EventManager::merge_posted_locked(std::size_t family) {
+  // Events of all threads are gathered in the first buffer, in thread order,
+  // then sorted by key.
+  BasePosted *merged = nullptr;
+  for (PostBuffer *buffer : post_buffers_) {
+    if (family >= buffer->posted.size() || !buffer->posted[family]) continue;
+    if (merged) {
+      merged->append(*buffer->posted[family]);
+    } else {
+      merged = buffer->posted[family];
+    }
+  }
+  if (merged) merged->merge(*this);
+}
+
+void EventManager::record_stats(std::size_t family, const char *name, std::chrono::steady_clock::time_point start,
+                                std::size_t invoked) {
+  std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - start;
+  if (family >= stats_.size())
+    stats_.resize(family + 1);
+  EventStats &stats = stats_[family];
+  std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  stats.name = name;
+  stats.emits++;
+  stats.receivers += invoked;
+  stats.nanoseconds += ns;
+  std::size_t bucket = 0;
+  while (bucket + 1 < EventStats::BUCKETS && ns >> (bucket + 1)) bucket++;
+  stats.histogram[bucket]++;
+  if (tracing_) {
+    TraceRecord record = {family, start, duration};
+    trace_.push_back(record);
+  }
+}
+
+void EventManager::reset_stats() {
+  // Names are kept for trace records.
+  for (EventStats &stats : stats_) {
+    const char *name = stats.name;
+    stats = EventStats();
+    stats.name = name;
+  }
+}
+
+void EventManager::write_stats(std::ostream &out) const {
+  out << "{\"events\": [";
+  bool first = true;
+  for (const EventStats &stats : stats_) {
+    if (!stats.name) continue;
+    out << (first ? "\n" : ",\n") << "  {\"name\": ";
+    write_string(out, demangle(stats.name));
+    out << ", \"emits\": " << stats.emits
+        << ", \"receivers\": " << stats.receivers
+        << ", \"total_ns\": " << stats.nanoseconds
+        << ", \"p50_ns\": " << stats.percentile(0.5)
+        << ", \"p90_ns\": " << stats.percentile(0.9)
+        << ", \"p99_ns\": " << stats.percentile(0.99) << "}";
+    first = false;
+  }
+  out << "\n]}\n";
+}
+
+void EventManager::start_trace() {
+  trace_.clear();
+  trace_start_ = std::chrono::steady_clock::now();
+  tracing_ = EVENT_STATS;
+}
+
+void EventManager::stop_trace() {
+  tracing_ = false;
+}
+
+void EventManager::write_trace(std::ostream &out) const {
+  out << "{\"traceEvents\": [";
+  bool first = true;
+  for (const TraceRecord &record : trace_) {
+    double ts = std::chrono::duration<double, std::micro>(record.start - trace_start_).count();
+    double dur = std::chrono::duration<double, std::micro>(record.duration).count();
+    out << (first ? "\n" : ",\n") << "  {\"name\": ";
+    write_string(out, demangle(stats_[record.family].name));
+    out << ", \"cat\": \"event\", \"ph\": \"X\", \"ts\": " << ts << ", \"dur\": " << dur
+        << ", \"pid\": 1, \"tid\": 1}";
+    first = false;
+  }
+  out << "\n]}\n";
+}
+
+namespace {
+
+// Recordings start with a magic number and version, followed by a record
+// per event: a 32-bit ID and the 32-bit size of the rest of the record, then
+// the event itself. IDs of targeted events have RECORDED_TARGET set, and the
+// event is preceded by its 64-bit target. Frames end with a record with an
+// ID of 0.
+const char RECORDING_MAGIC[4] = {'E', 'X', 'E', 'V'};
+const std::uint32_t RECORDING_VERSION = 2;
+const std::uint32_t RECORDED_TARGET = 0x80000000u;
+
+void write_u32(std::ostream &out, std::uint32_t value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+void EventManager::end_frame() {
+  frame_arena_.reset();
+  for (BaseEventStream *stream : streams_) {
+    if (stream) stream->swap();
+  }
+  if (recording_) {
+    write_u32(*recording_, 0);
+    write_u32(*recording_, 0);
+  }
+}
+
+void EventManager::register_event(std::size_t family, std::uint32_t id, std::uint32_t size, ReplayThunk replay) {
+  assert(id != 0 && "Event ID 0 is reserved");
+  assert(!(id & RECORDED_TARGET) && "Event IDs must be below 2^31");
+  assert((registered_families_.find(id) == registered_families_.end() || registered_families_[id] == family) &&
+         "Event ID is already registered to another event type");
+  if (family >= registry_.size())
+    registry_.resize(family + 1, Registration{0, 0, nullptr});
+  registry_[family] = Registration{id, size, replay};
+  registered_families_[id] = family;
+}
+
+void EventManager::start_recording(std::ostream &out) {
+  out.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+  write_u32(out, RECORDING_VERSION);
+  recording_ = &out;
+  recording_depth_ = 0;
+}
+
+void EventManager::stop_recording() {
+  if (recording_) recording_->flush();
+  recording_ = nullptr;
+}
+
+void EventManager::record_event(std::size_t family, const void *event, bool targeted, std::uint64_t target) {
+  if (family >= registry_.size() || !registry_[family].id) return;
+  const Registration &registration = registry_[family];
+  if (targeted) {
+    write_u32(*recording_, registration.id | RECORDED_TARGET);
+    write_u32(*recording_, sizeof(target) + registration.size);
+    recording_->write(reinterpret_cast<const char*>(&target), sizeof(target));
+  } else {
+    write_u32(*recording_, registration.id);
+    write_u32(*recording_, registration.size);
+  }
+  recording_->write(static_cast<const char*>(event), registration.size);
+}
+
+EventReplayer::EventReplayer(std::istream &in)
+    : data_((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()) {
+  std::uint32_t version = 0;
+  if (data_.size() < sizeof(RECORDING_MAGIC) + sizeof(version)) return;
+  if (!std::equal(RECORDING_MAGIC, RECORDING_MAGIC + sizeof(RECORDING_MAGIC), data_.begin())) return;
+  std::memcpy(&version, data_.data() + sizeof(RECORDING_MAGIC), sizeof(version));
+  if (version != RECORDING_VERSION) return;
+  data_.erase(data_.begin(), data_.begin() + sizeof(RECORDING_MAGIC) + sizeof(version));
+  valid_ = true;
+}
+
+EventReplayer::Step EventReplayer::step(EventManager &events) {
+  std::uint32_t header[2];
+  if (!valid_ || offset_ + sizeof(header) > data_.size()) return END;
+  std::memcpy(header, data_.data() + offset_, sizeof(header));
+  std::uint32_t id = header[0], size = header[1];
+  if (offset_ + sizeof(header) + size > data_.size()) {
+    // Truncated.
+    offset_ = data_.size();
+    return END;
+  }
+  const char *event = data_.data() + offset_ + sizeof(header);
+  offset_ += sizeof(header) + size;
+  if (!id) return FRAME;
+  const bool targeted = id & RECORDED_TARGET;
+  std::uint64_t target = 0;
+  if (targeted) {
+    if (size < sizeof(target)) return SKIPPED;
+    std::memcpy(&target, event, sizeof(target));
+    event += sizeof(target);
+    size -= sizeof(target);
+    id &= ~RECORDED_TARGET;
+  }
+  auto it = events.registered_families_.find(id);
+  if (it == events.registered_families_.end()) return SKIPPED;
+  const EventManager::Registration &registration = events.registry_[it->second];
+  if (registration.size != size) return SKIPPED;
+  // Copied, as events in the recording are not aligned.
+  event_.resize((size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+  std::memcpy(event_.data(), event, size);
+  registration.replay(events, event_.data(), targeted, target);
+  return EMITTED;
+}
+
+bool EventReplayer::replay_frame(EventManager &events) {
+  if (!valid_ || offset_ >= data_.size()) return false;
+  Step result;
+  do {
+    result = step(events);
+  } while (result != FRAME && result != END);
+  return result == FRAME;
+}
+
+std::size_t EventReplayer::replay(EventManager &events) {
+  std::size_t emitted = 0;
+  Step result;
+  while ((result = step(events)) != END) {
+    if (result == EMITTED) emitted++;
+  }
+  return emitted;
 }
 
 }  // namespace entityx
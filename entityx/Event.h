@@ -10,20 +10,34 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
+#include <mutex>
+#include <thread>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <type_traits>
+#include <typeinfo>
 #include <vector>
 #include <list>
 #include <unordered_map>
 #include <memory>
 #include <utility>
 #include "entityx/config.h"
-#include "entityx/3rdparty/simplesignal.h"
+#include "entityx/help/Arena.h"
 #include "entityx/help/NonCopyable.h"
+#include "entityx/help/SmallVector.h"
 
 
 namespace entityx {
 
+class EventManager;
+
 
 /// Used internally by the EventManager.
 class BaseEvent {
@@ -33,11 +47,139 @@ class BaseEvent {
   virtual ~BaseEvent();
 
  protected:
-  static Family family_counter_;
+  // Atomic, as event types may first be used by threads posting events.
+  static std::atomic<Family> family_counter_;
+};
+
+
+/**
+ * A member function bound to an object: a pointer to the object, and a
+ * thunk generated at compile time for the member function. Calling it is a
+ * single indirect call, and binding never allocates.
+ *
+ *     Delegate delegate = Delegate::bind<Explosion, DamageSystem, &DamageSystem::on_explosion>(system);
+ *     delegate(&explosion);
+ */
+struct Delegate {
+  /// Returns true if the receiver consumed the event.
+  typedef bool (*Thunk)(void *receiver, const void *event);
+
+  template <typename E, typename Receiver, void (Receiver::*Method)(const E &)>
+  static Delegate bind(Receiver &receiver) {
+    Delegate delegate = {&receiver, &Delegate::call<E, Receiver, Method>};
+    return delegate;
+  }
+
+  /// Binds a member function that returns true to consume events.
+  template <typename E, typename Receiver, bool (Receiver::*Method)(const E &)>
+  static Delegate bind(Receiver &receiver) {
+    Delegate delegate = {&receiver, &Delegate::call<E, Receiver, Method>};
+    return delegate;
+  }
+
+  bool operator () (const void *event) const { return thunk(receiver, event); }
+
+  void *receiver;
+  Thunk thunk;
+
+ private:
+  template <typename E, typename Receiver, void (Receiver::*Method)(const E &)>
+  static bool call(void *receiver, const void *event) {
+    (static_cast<Receiver*>(receiver)->*Method)(*static_cast<const E*>(event));
+    return false;
+  }
+
+  template <typename E, typename Receiver, bool (Receiver::*Method)(const E &)>
+  static bool call(void *receiver, const void *event) {
+    return (static_cast<Receiver*>(receiver)->*Method)(*static_cast<const E*>(event));
+  }
 };
 
 
-typedef Simple::Signal<void (const void*)> EventSignal;
+/**
+ * The receivers of one type of event, stored contiguously as delegates so
+ * that emitting is a linear scan with one indirect call per receiver.
+ *
+ * Receivers are called in descending order of priority, and in connection
+ * order within a priority. A receiver can consume an event by returning true,
+ * in which case the remaining receivers do not receive it.
+ *
+ * Receivers may connect and disconnect while an event is being emitted.
+ * Receivers connected during emission do not receive that event.
+ */
+class EventSignal {
+ public:
+  /**
+   * Returns a connection handle for disconnect(), which finds the receiver
+   * in constant time. Disconnecting with a stale handle does nothing.
+   */
+  std::uint64_t connect(Delegate delegate, int priority = 0);
+  void disconnect(std::uint64_t connection);
+
+  /**
+   * Returns true if a receiver consumed the event. If invoked is given, it
+   * is incremented for each receiver called.
+   */
+  bool emit(const void *event, std::size_t *invoked = nullptr) {
+    const std::size_t size = slots_.size();
+    EmitGuard guard(*this);
+    for (std::size_t i = 0; i < size; i++) {
+      // slots_ is not reallocated during emission.
+      const Delegate &delegate = slots_[i].delegate;
+      if (delegate.receiver && invoked) ++*invoked;
+      if (delegate.receiver && delegate(event)) return true;
+    }
+    return false;
+  }
+
+  bool empty() const { return connected_ == 0; }
+  std::size_t size() const { return connected_; }
+  bool emitting() const { return emitting_ > 0; }
+
+ private:
+  struct Slot {
+    Delegate delegate;
+    std::uint32_t handle;
+    int priority;
+  };
+
+  // Locates the slot of a connection. The generation is incremented when the
+  // connection is disconnected, invalidating its outstanding handle.
+  struct Handle {
+    std::uint32_t position;
+    std::uint32_t generation;
+  };
+
+  // Position of handles whose slots are in connecting_.
+  static const std::uint32_t PENDING = ~std::uint32_t(0);
+
+  // Ends an emission, even if a receiver throws.
+  struct EmitGuard {
+    explicit EmitGuard(EventSignal &signal) : signal(signal) { ++signal.emitting_; }
+    ~EmitGuard() {
+      if (--signal.emitting_ == 0 && (!signal.connecting_.empty() || signal.holes_ * 2 > signal.slots_.size()))
+        signal.flush();
+    }
+
+    EventSignal &signal;
+  };
+
+  void insert(const Slot &slot);
+  // Remove holes left by disconnected slots once there are enough of them,
+  // and insert slots connected during emission.
+  void flush();
+
+  std::vector<Slot> slots_;
+  // Connected during emission.
+  std::vector<Slot> connecting_;
+  std::vector<Handle> handles_;
+  std::vector<std::uint32_t> free_handles_;
+  std::size_t connected_ = 0;
+  // Disconnected slots, with a null receiver, in slots_.
+  std::size_t holes_ = 0;
+  int emitting_ = 0;
+};
+
 typedef std::shared_ptr<EventSignal> EventSignalPtr;
 typedef std::weak_ptr<EventSignal> EventSignalWeakPtr;
 
@@ -63,20 +205,18 @@ class Event : public BaseEvent {
 
 class BaseReceiver {
  public:
-  virtual ~BaseReceiver() {
-    for (auto connection : connections_) {
-      auto &ptr = connection.second.first;
-      if (!ptr.expired()) {
-        ptr.lock()->disconnect(connection.second.second);
-      }
-    }
-  }
+  BaseReceiver() {}
+  // Subscriptions are bound to the address of a receiver, so copies start
+  // out unsubscribed, and assignment leaves subscriptions alone.
+  BaseReceiver(const BaseReceiver &) {}
+  BaseReceiver &operator = (const BaseReceiver &) { return *this; }
+  virtual ~BaseReceiver();
 
   // Return number of signals connected to this receiver.
   std::size_t connected_signals() const {
     std::size_t size = 0;
-    for (auto connection : connections_) {
-      if (!connection.second.first.expired()) {
+    for (auto &connection : connections_) {
+      if (!connection.signal.expired()) {
         size++;
       }
     }
@@ -85,7 +225,19 @@ class BaseReceiver {
 
  private:
   friend class EventManager;
-  std::unordered_map<BaseEvent::Family, std::pair<EventSignalWeakPtr, std::size_t>> connections_;
+
+  struct Connection {
+    BaseEvent::Family family;
+    bool targeted;
+    std::uint64_t target;
+    EventSignalWeakPtr signal;
+    std::uint64_t id;
+    // Owner of the signal, used to release empty target signals.
+    EventManager *manager;
+  };
+
+  // Stored inline, as receivers rarely have more than a couple of connections.
+  help::SmallVector<Connection, 2> connections_;
 };
 
 
@@ -96,6 +248,85 @@ class Receiver : public BaseReceiver {
 };
 
 
+/// Used internally by the EventManager.
+class BaseEventStream {
+ public:
+  virtual ~BaseEventStream() {}
+  virtual void swap() = 0;
+};
+
+
+/**
+ * A double buffered stream of events, for events read by several systems at
+ * different points of a frame.
+ *
+ * Producers push() events into the write buffer during a frame. Readers
+ * iterate over the events pushed during the previous frame, without
+ * subscribing or copying them, and swap() makes the write buffer readable.
+ *
+ * The read buffer is not modified until swap(), so any number of threads may
+ * read it concurrently. push() is not thread-safe (see EventManager::post()).
+ *
+ *     for (const Collision &collision : em.stream<Collision>()) {
+ *     }
+ */
+template <typename E>
+class EventStream : public BaseEventStream, entityx::help::NonCopyable {
+ public:
+  typedef typename std::vector<E>::const_iterator const_iterator;
+
+  template <typename ... Args>
+  void push(Args && ... args) {
+    writing_.push_back(E(std::forward<Args>(args) ...));
+  }
+
+  void push(const E &event) {
+    writing_.push_back(event);
+  }
+
+  /// Make the events pushed since the last swap() readable, and discard those that were.
+  void swap() override {
+    reading_.swap(writing_);
+    writing_.clear();
+  }
+
+  /// Events pushed before the last swap().
+  const std::vector<E> &events() const { return reading_; }
+  const_iterator begin() const { return reading_.begin(); }
+  const_iterator end() const { return reading_.end(); }
+  std::size_t size() const { return reading_.size(); }
+  bool empty() const { return reading_.empty(); }
+
+  /// Number of events pushed since the last swap().
+  std::size_t pending() const { return writing_.size(); }
+
+ private:
+  std::vector<E> reading_;
+  std::vector<E> writing_;
+};
+
+
+/**
+ * Dispatch statistics for one type of event, collected when EntityX is
+ * built with -DENTITYX_EVENT_STATS=1.
+ */
+struct EventStats {
+  /// Number of buckets in histogram: bucket i counts dispatches taking
+  /// [2^i, 2^(i+1)) nanoseconds.
+  static const std::size_t BUCKETS = 40;
+
+  /// Type name of the event, as given by typeid, or nullptr if never emitted.
+  const char *name = nullptr;
+  std::uint64_t emits = 0;
+  std::uint64_t receivers = 0;
+  std::uint64_t nanoseconds = 0;
+  std::uint64_t histogram[BUCKETS] = {};
+
+  /// Upper bound, in nanoseconds, of the time taken by fraction p of dispatches.
+  std::uint64_t percentile(double p) const;
+};
+
+
 /**
  * Handles event subscription and delivery.
  *
@@ -120,15 +351,31 @@ class EventManager : entityx::help::NonCopyable {
    *
    *     ExplosionReceiver receiver;
    *     em.subscribe<Explosion>(receiver);
+   *
+   * Receivers with a higher priority receive events first. A receive()
+   * method may return bool instead of void, and return true to consume the
+   * event, so that receivers after it do not receive it.
    */
   template <typename E, typename Receiver>
-  void subscribe(Receiver &receiver) {
-    void (Receiver::*receive)(const E &) = &Receiver::receive;
-    auto sig = signal_for(Event<E>::family());
-    auto wrapper = EventCallbackWrapper<E>(std::bind(receive, &receiver, std::placeholders::_1));
-    auto connection = sig->connect(wrapper);
-    BaseReceiver &base = receiver;
-    base.connections_.insert(std::make_pair(Event<E>::family(), std::make_pair(EventSignalWeakPtr(sig), connection)));
+  void subscribe(Receiver &receiver, int priority = 0) {
+    check_receiver<E, Receiver>();
+    Delegate delegate = {&receiver, &EventManager::invoke<E, Receiver>};
+    connect(receiver, Event<E>::family(), false, 0, delegate, priority);
+  }
+
+  /**
+   * Subscribe a member function other than receive() to events of type E:
+   *
+   *     em.subscribe<Explosion, DamageSystem, &DamageSystem::on_explosion>(system);
+   */
+  template <typename E, typename Receiver, void (Receiver::*Method)(const E &)>
+  void subscribe(Receiver &receiver, int priority = 0) {
+    connect(receiver, Event<E>::family(), false, 0, Delegate::bind<E, Receiver, Method>(receiver), priority);
+  }
+
+  template <typename E, typename Receiver, bool (Receiver::*Method)(const E &)>
+  void subscribe(Receiver &receiver, int priority = 0) {
+    connect(receiver, Event<E>::family(), false, 0, Delegate::bind<E, Receiver, Method>(receiver), priority);
   }
 
   /**
@@ -139,37 +386,93 @@ class EventManager : entityx::help::NonCopyable {
    */
   template <typename E, typename Receiver>
   void unsubscribe(Receiver &receiver) {
-    BaseReceiver &base = receiver;
+    bool found = disconnect(receiver, Event<E>::family(), false, 0);
     //Assert that it has been subscribed before
-    assert(base.connections_.find(Event<E>::family()) != base.connections_.end());
-    auto pair = base.connections_[Event<E>::family()];
-    auto connection = pair.second;
-    auto &ptr = pair.first;
-    if (!ptr.expired()) {
-      ptr.lock()->disconnect(connection);
+    assert(found);
+    (void)found;
+  }
+
+  /**
+   * Subscribe an object to receive only the events of type E emitted with
+   * emit_to() for the given target, typically an Entity::Id:
+   *
+   *     em.subscribe_to<Damage>(entity.id().id(), receiver);
+   *     em.emit_to<Damage>(entity.id().id(), 10);
+   *
+   * Targeted events are looked up by target, so their cost does not depend
+   * on how many other targets have receivers.
+   */
+  template <typename E, typename Receiver>
+  void subscribe_to(std::uint64_t target, Receiver &receiver, int priority = 0) {
+    check_receiver<E, Receiver>();
+    Delegate delegate = {&receiver, &EventManager::invoke<E, Receiver>};
+    connect(receiver, Event<E>::family(), true, target, delegate, priority);
+  }
+
+  /**
+   * Unsubscribe an object from events of type E for the given target.
+   */
+  template <typename E, typename Receiver>
+  void unsubscribe_from(std::uint64_t target, Receiver &receiver) {
+    bool found = disconnect(receiver, Event<E>::family(), true, target);
+    assert(found);
+    (void)found;
+  }
+
+  /**
+   * Emit an event of type E only to the receivers subscribed to the given
+   * target. If there are none, the event is not constructed.
+   *
+   * Returns true if a receiver consumed the event.
+   */
+  template <typename E, typename ... Args>
+  bool emit_to(std::uint64_t target, Args && ... args) {
+    EventSignal *signal = target_signal(Event<E>::family(), target);
+    if (!signal) {
+      measure_unreceived<E>();
+      // Recorded regardless, as there may be receivers on replay.
+      if (recording(Event<E>::family())) {
+        E event = E(std::forward<Args>(args) ...);
+        record_event(Event<E>::family(), &event, true, target);
+      }
+      return false;
     }
-    base.connections_.erase(Event<E>::family());
+    E event = E(std::forward<Args>(args) ...);
+    bool consumed = dispatch<E>(*signal, &event, true, target);
+    // Receivers may have unsubscribed, or been destroyed, during emission.
+    if (signal->empty()) release_target(Event<E>::family(), target);
+    return consumed;
   }
 
+  /// Returns true if a receiver consumed the event.
   template <typename E>
-  void emit(const E &event) {
-    auto sig = signal_for(Event<E>::family());
-    sig->emit(&event);
+  bool emit(const E &event) {
+    if (!has_receivers<E>()) {
+      measure_unreceived<E>();
+      if (recording(Event<E>::family())) record_event(Event<E>::family(), &event);
+      return false;
+    }
+    return dispatch<E>(*handlers_[Event<E>::family()], &event);
   }
 
   /**
    * Emit an already constructed event.
    */
   template <typename E>
-  void emit(std::unique_ptr<E> event) {
-    auto sig = signal_for(Event<E>::family());
-    sig->emit(event.get());
+  bool emit(std::unique_ptr<E> event) {
+    if (!has_receivers<E>()) {
+      measure_unreceived<E>();
+      if (recording(Event<E>::family())) record_event(Event<E>::family(), event.get());
+      return false;
+    }
+    return dispatch<E>(*handlers_[Event<E>::family()], event.get());
   }
 
   /**
    * Emit an event to receivers.
    *
    * This method constructs a new event object of type E with the provided arguments, then delivers it to all receivers.
+   * If there are no receivers, the event is not constructed at all.
    *
    * eg.
    *
@@ -178,18 +481,221 @@ class EventManager : entityx::help::NonCopyable {
    *
    */
   template <typename E, typename ... Args>
-  void emit(Args && ... args) {
+  bool emit(Args && ... args) {
+    // Don't even construct the event if no one is listening, unless it is
+    // being recorded, as there may be receivers on replay.
+    if (!has_receivers<E>()) {
+      measure_unreceived<E>();
+      if (recording(Event<E>::family())) {
+        E event = E(std::forward<Args>(args) ...);
+        record_event(Event<E>::family(), &event);
+      }
+      return false;
+    }
     // Using 'E event(std::forward...)' causes VS to fail with an internal error. Hack around it.
     E event = E(std::forward<Args>(args) ...);
-    auto sig = signal_for(std::size_t(Event<E>::family()));
-    sig->emit(&event);
+    return dispatch<E>(*handlers_[Event<E>::family()], &event);
+  }
+
+  /**
+   * Queue an event for delivery by the next update<E>() or update_all().
+   *
+   * Queued events of each type are stored contiguously, and delivered
+   * together. Receivers subscribed to std::vector<E> receive the whole batch
+   * in one call, before receivers of E receive each event in turn:
+   *
+   *     struct CollisionReceiver : public Receiver<CollisionReceiver> {
+   *       void receive(const std::vector<Collision> &collisions) {
+   *       }
+   *     };
+   *
+   *     em.subscribe<std::vector<Collision>>(receiver);
+   *     em.enqueue<Collision>(left, right);
+   *     em.update<Collision>();
+   */
+  template <typename E, typename ... Args>
+  void enqueue(Args && ... args) {
+    queue_for<E>().pending.push_back(E(std::forward<Args>(args) ...));
+  }
+
+  template <typename E>
+  void enqueue(const E &event) {
+    queue_for<E>().pending.push_back(event);
+  }
+
+  /**
+   * Deliver all queued events of type E.
+   *
+   * Events queued by receivers during delivery are kept for the next update.
+   */
+  template <typename E>
+  void update() {
+    if (posting_) merge_posted(Event<E>::family());
+    std::size_t family = Event<E>::family();
+    if (family < queues_.size() && queues_[family]) queues_[family]->deliver(*this);
+  }
+
+  /// Deliver all queued events, one type at a time.
+  void update_all();
+
+  /**
+   * Queue an event from any thread.
+   *
+   * Posted events are held apart from the single-threaded machinery, in a
+   * buffer per posting thread, and merged into the queue for E by the next
+   * update<E>() or update_all() on the thread that owns the EventManager.
+   * That is the synchronisation point: workers must have finished posting
+   * (eg. been joined) before it.
+   *
+   * Posted events are delivered after events queued with enqueue(), in the
+   * order in which each thread posted them, one thread after another.
+   */
+  template <typename E, typename ... Args>
+  void post(Args && ... args) {
+    post_ordered<E>(0, std::forward<Args>(args) ...);
+  }
+
+  /**
+   * Queue an event from any thread, delivering posted events of type E in
+   * ascending order of the given key, rather than the order in which threads
+   * happened to post them. Events with equal keys keep their posted order.
+   *
+   * eg. keying by job index makes delivery independent of scheduling:
+   *
+   *     em.post_ordered<Collision>(job, left, right);
+   */
+  template <typename E, typename ... Args>
+  void post_ordered(std::uint64_t order, Args && ... args) {
+    E event = E(std::forward<Args>(args) ...);
+    std::vector<BasePosted*> &posted = post_buffer().posted;
+    std::size_t family = Event<E>::family();
+    if (family >= posted.size())
+      posted.resize(family + 1);
+    if (!posted[family])
+      posted[family] = new Posted<E>();
+    static_cast<Posted<E>*>(posted[family])->events.emplace_back(order, std::move(event));
+  }
+
+  /// Number of events of type E waiting for update<E>().
+  template <typename E>
+  std::size_t queued() const {
+    std::size_t family = Event<E>::family();
+    return family < queues_.size() && queues_[family] ? queues_[family]->size() : 0;
+  }
+
+  /**
+   * An arena for event data that must outlive dispatch, such as payloads of
+   * queued events, released wholesale by end_frame():
+   *
+   *     const float *samples = em.frame_arena().copy(buffer.data(), buffer.size());
+   *     em.enqueue<Sound>(samples, buffer.size());
+   *     ...
+   *     em.update_all();
+   *     em.end_frame();
+   */
+  Arena &frame_arena() { return frame_arena_; }
+
+  /**
+   * Destroy everything allocated from frame_arena(), keeping its memory, and
+   * swap() every stream().
+   *
+   * When recording, also marks the end of a frame in the recording.
+   */
+  void end_frame();
+
+  /**
+   * The stream of events of type E, swapped by end_frame().
+   *
+   * As streamed events are read during the frame after they were pushed, they
+   * must not refer to data in frame_arena().
+   */
+  template <typename E>
+  EventStream<E> &stream() {
+    std::size_t family = Event<E>::family();
+    if (family >= streams_.size())
+      streams_.resize(family + 1);
+    if (!streams_[family])
+      streams_[family] = new EventStream<E>();
+    return *static_cast<EventStream<E>*>(streams_[family]);
+  }
+
+  /**
+   * Register a trivially copyable event type for recording under an ID
+   * that, unlike Event<E>::family(), does not depend on the order in which
+   * event types are first used. IDs must be non-zero, unique and below
+   * 2^31.
+   *
+   *     em.register_event<Collision>(1);
+   *     em.register_event<Explosion>(2);
+   */
+  template <typename E>
+  void register_event(std::uint32_t id) {
+    static_assert(std::is_trivially_copyable<E>::value, "Only trivially copyable events can be recorded");
+    register_event(Event<E>::family(), id, sizeof(E), &EventManager::replay<E>);
+  }
+
+  /**
+   * Write events of registered types to out as they are emitted, until
+   * stop_recording(). Events dispatched by receivers, while handling another
+   * event, are not recorded, as replaying the outer event recreates them.
+   *
+   * Events are recorded even if nothing receives them. Queued events are
+   * recorded when delivered, and replayed as emitted events. Targeted events
+   * are recorded with their target, and replayed with emit_to().
+   *
+   * The format is native endian: a recording should be replayed on the
+   * platform it was recorded on, with the same event IDs.
+   */
+  void start_recording(std::ostream &out);
+  void stop_recording();
+
+  /**
+   * Per-family dispatch statistics, indexed by Event<E>::family(). Always
+   * empty unless built with -DENTITYX_EVENT_STATS=1.
+   */
+  const std::vector<EventStats> &stats() const { return stats_; }
+  void reset_stats();
+
+  /// Write stats() as a JSON object.
+  void write_stats(std::ostream &out) const;
+
+  /**
+   * Record each dispatch between start_trace() and stop_trace(), for
+   * write_trace() to write in Chrome's trace event format (for
+   * chrome://tracing or Perfetto). Requires -DENTITYX_EVENT_STATS=1.
+   */
+  void start_trace();
+  void stop_trace();
+  void write_trace(std::ostream &out) const;
+
+  /**
+   * Check whether any receivers are subscribed to events of type E, without
+   * counting them.
+   */
+  template <typename E>
+  bool has_receivers() const {
+    std::size_t family = Event<E>::family();
+    return family < handlers_.size() && handlers_[family] && !handlers_[family]->empty();
+  }
+
+  /**
+   * The number of targets with receivers subscribed to events of type E
+   * (see subscribe_to()).
+   */
+  template <typename E>
+  std::size_t subscribed_targets() const {
+    std::size_t family = Event<E>::family();
+    return family < targets_.size() ? targets_[family].size() : 0;
   }
 
   std::size_t connected_receivers() const {
     std::size_t size = 0;
-    for (EventSignalPtr handler : handlers_) {
+    for (const EventSignalPtr &handler : handlers_) {
       if (handler) size += handler->size();
     }
+    for (auto &targets : targets_) {
+      for (auto &target : targets) size += target.second->size();
+    }
     return size;
   }
 
@@ -202,15 +708,277 @@ class EventManager : entityx::help::NonCopyable {
     return handlers_[id];
   }
 
-  // Functor used as an event signal callback that casts to E.
+  void connect(BaseReceiver &receiver, std::size_t family, bool targeted, std::uint64_t target, Delegate delegate,
+               int priority);
+  // Disconnects all matching connections, returning false if there were none.
+  bool disconnect(BaseReceiver &receiver, std::size_t family, bool targeted, std::uint64_t target);
+
+  // Checks that Receiver has a matching receive().
+  template <typename E, typename Receiver>
+  static void check_receiver() {
+    typedef decltype(std::declval<Receiver &>().receive(std::declval<const E &>())) Result;
+    static_assert(std::is_void<Result>::value || std::is_same<Result, bool>::value,
+                  "receive() must return void, or bool to consume events");
+  }
+
+  friend class EventReplayer;
+  friend class BaseReceiver;
+
+  // Emit an event through signal, recording it and statistics if enabled.
+  template <typename E>
+  bool dispatch(EventSignal &signal, const void *event, bool targeted = false, std::uint64_t target = 0) {
+    if (recording_) {
+      if (!recording_depth_) record_event(Event<E>::family(), event, targeted, target);
+      ++recording_depth_;
+      bool consumed = measure<E>(signal, event);
+      --recording_depth_;
+      return consumed;
+    }
+    return measure<E>(signal, event);
+  }
+
+  // Statistics are compiled out unless enabled, so that typeid() and timing
+  // code are never instantiated (eg. in -fno-rtti builds).
+  template <typename E>
+  bool measure(EventSignal &signal, const void *event) {
+#if ENTITYX_EVENT_STATS
+    std::size_t invoked = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool consumed = signal.emit(event, &invoked);
+    record_stats(Event<E>::family(), typeid(E).name(), start, invoked);
+    return consumed;
+#else
+    return signal.emit(event);
+#endif
+  }
+
+  // Count an emit that found no receivers, so that it still shows up in
+  // stats() and traces.
   template <typename E>
-  struct EventCallbackWrapper {
-    EventCallbackWrapper(std::function<void(const E &)> callback) : callback(callback) {}
-    void operator()(const void *event) { callback(*(static_cast<const E*>(event))); }
-    std::function<void(const E &)> callback;
+  void measure_unreceived() {
+#if ENTITYX_EVENT_STATS
+    record_stats(Event<E>::family(), typeid(E).name(), std::chrono::steady_clock::now(), 0);
+#endif
+  }
+
+  void record_stats(std::size_t family, const char *name, std::chrono::steady_clock::time_point start,
+                    std::size_t invoked);
+
+  typedef void (*ReplayThunk)(EventManager &events, const void *event, bool targeted, std::uint64_t target);
+
+  template <typename E>
+  static void replay(EventManager &events, const void *event, bool targeted, std::uint64_t target) {
+    if (targeted) {
+      events.emit_to<E>(target, *static_cast<const E*>(event));
+    } else {
+      events.emit(*static_cast<const E*>(event));
+    }
+  }
+
+  struct Registration {
+    std::uint32_t id;
+    std::uint32_t size;
+    ReplayThunk replay;
+  };
+
+  void register_event(std::size_t family, std::uint32_t id, std::uint32_t size, ReplayThunk replay);
+  void record_event(std::size_t family, const void *event, bool targeted = false, std::uint64_t target = 0);
+
+  // Whether events of a family dispatched now would be recorded.
+  bool recording(std::size_t family) const {
+    return recording_ && !recording_depth_ && family < registry_.size() && registry_[family].id;
+  }
+
+  // The signal for events of a family aimed at target, or nullptr if there
+  // is none or it has no receivers. Never erases signals.
+  EventSignal *target_signal(std::size_t family, std::uint64_t target);
+  // Erase the signal for a target once it has no receivers.
+  void release_target(std::size_t family, std::uint64_t target);
+
+  // Delivers an untyped event to a Receiver.
+  template <typename E, typename Receiver>
+  static bool invoke(void *receiver, const void *event) {
+    Receiver *typed = static_cast<Receiver*>(receiver);
+    typedef decltype(typed->receive(*static_cast<const E*>(event))) Result;
+    return invoke(typed, *static_cast<const E*>(event), std::is_same<Result, bool>());
+  }
+
+  template <typename E, typename Receiver>
+  static bool invoke(Receiver *receiver, const E &event, std::true_type consumable) {
+    return receiver->receive(event);
+  }
+
+  template <typename E, typename Receiver>
+  static bool invoke(Receiver *receiver, const E &event, std::false_type consumable) {
+    receiver->receive(event);
+    return false;
+  }
+
+  struct BaseQueue {
+    virtual ~BaseQueue() {}
+    virtual void deliver(EventManager &events) = 0;
+    virtual std::size_t size() const = 0;
+  };
+
+  template <typename E>
+  struct Queue : public BaseQueue {
+    void deliver(EventManager &events) override {
+      // Swapped out, so that receivers can queue further events; delivering
+      // is only non-empty if update<E>() is called re-entrantly.
+      if (pending.empty() || !delivering.empty()) return;
+      delivering.swap(pending);
+      // Recorded up front, as a batch receiver can consume the whole batch.
+      const bool recording = events.recording(Event<E>::family());
+      if (recording) {
+        for (const E &event : delivering) events.record_event(Event<E>::family(), &event);
+        ++events.recording_depth_;
+      }
+      if (!events.emit(delivering) && events.has_receivers<E>()) {
+        EventSignal *signal = events.handlers_[Event<E>::family()].get();
+        for (const E &event : delivering) events.dispatch<E>(*signal, &event);
+      }
+      if (recording) --events.recording_depth_;
+      delivering.clear();
+    }
+
+    std::size_t size() const override { return pending.size(); }
+
+    std::vector<E> pending;
+    std::vector<E> delivering;
+  };
+
+  struct BasePosted {
+    virtual ~BasePosted() {}
+    // Move the events of other, which must be of the same type, after these.
+    virtual void append(BasePosted &other) = 0;
+    // Move posted events into the queue for their type.
+    virtual void merge(EventManager &events) = 0;
+  };
+
+  template <typename E>
+  struct Posted : public BasePosted {
+    void append(BasePosted &other) override {
+      std::vector<std::pair<std::uint64_t, E>> &from = static_cast<Posted<E>&>(other).events;
+      std::move(from.begin(), from.end(), std::back_inserter(this->events));
+      from.clear();
+    }
+
+    void merge(EventManager &events) override {
+      if (this->events.empty()) return;
+      std::stable_sort(this->events.begin(), this->events.end(),
+                       [](const std::pair<std::uint64_t, E> &a, const std::pair<std::uint64_t, E> &b) {
+                         return a.first < b.first;
+                       });
+      std::vector<E> &pending = events.queue_for<E>().pending;
+      for (auto &posted : this->events) pending.push_back(std::move(posted.second));
+      this->events.clear();
+    }
+
+    std::vector<std::pair<std::uint64_t, E>> events;
   };
 
+  // Events posted by one thread, by family.
+  struct PostBuffer {
+    ~PostBuffer() {
+      for (BasePosted *p : posted) delete p;
+    }
+
+    std::thread::id thread;
+    std::vector<BasePosted*> posted;
+  };
+
+  // The calling thread's PostBuffer. Threads look up their buffer under
+  // posted_mutex_ only on their first post since the last merge.
+  PostBuffer &post_buffer();
+
+  // Merge posted events of one family, or of all families.
+  void merge_posted(std::size_t family);
+  void merge_posted();
+  void merge_posted_locked(std::size_t family);
+
+  template <typename E>
+  Queue<E> &queue_for() {
+    std::size_t family = Event<E>::family();
+    if (family >= queues_.size())
+      queues_.resize(family + 1);
+    if (!queues_[family])
+      queues_[family] = new Queue<E>();
+    return *static_cast<Queue<E>*>(queues_[family]);
+  }
+
   std::vector<EventSignalPtr> handlers_;
+  // Signals of targeted events, by family and target.
+  std::vector<std::unordered_map<std::uint64_t, EventSignalPtr>> targets_;
+  std::vector<BaseQueue*> queues_;
+  std::vector<BaseEventStream*> streams_;
+  // Guards the lists of post buffers, not their contents. posting_ lets the
+  // single-threaded path skip it, and post_epoch_ changes whenever buffers
+  // are recycled, invalidating the threads' cached buffers.
+  std::mutex posted_mutex_;
+  std::vector<PostBuffer*> post_buffers_;
+  std::vector<PostBuffer*> spare_post_buffers_;
+  std::atomic<bool> posting_{false};
+  std::atomic<std::uint64_t> post_epoch_;
+  Arena frame_arena_;
+  std::vector<EventStats> stats_;
+  struct TraceRecord {
+    std::size_t family;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration duration;
+  };
+  // Indexed by family; registrations with id 0 are unregistered.
+  std::vector<Registration> registry_;
+  std::unordered_map<std::uint32_t, std::size_t> registered_families_;
+  std::ostream *recording_ = nullptr;
+  int recording_depth_ = 0;
+  bool tracing_ = false;
+  std::chrono::steady_clock::time_point trace_start_;
+  std::vector<TraceRecord> trace_;
+};
+
+
+/**
+ * Replays a recording made with EventManager::start_recording() into an
+ * EventManager, whose registered event IDs must match those used when
+ * recording.
+ *
+ * The recording is read into memory up front, so that replay() and
+ * replay_frame() measure event delivery rather than I/O.
+ *
+ *     std::ifstream in("frames.bin", std::ios::binary);
+ *     EventReplayer replayer(in);
+ *     while (replayer.replay_frame(em)) {}
+ */
+class EventReplayer {
+ public:
+  explicit EventReplayer(std::istream &in);
+
+  /// False if the recording could not be read.
+  bool valid() const { return valid_; }
+
+  /**
+   * Emit the events of the next frame. Returns false if the recording ended
+   * before the frame did, including when there are no frames left.
+   */
+  bool replay_frame(EventManager &events);
+
+  /// Emit all remaining events, returning the number emitted.
+  std::size_t replay(EventManager &events);
+
+  /// Start again from the first frame.
+  void rewind() { offset_ = 0; }
+
+ private:
+  enum Step { EMITTED, SKIPPED, FRAME, END };
+
+  // Read the next record, emitting it if it is an event of a registered type.
+  Step step(EventManager &events);
+
+  std::vector<char> data_;
+  std::size_t offset_ = 0;
+  // Event storage with suitable alignment.
+  std::vector<std::max_align_t> event_;
+  bool valid_ = false;
 };
 
 }  // namespace entityx
@@ -10,7 +10,11 @@
 
 #define CATCH_CONFIG_MAIN
 
+#include <memory>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include "entityx/3rdparty/catch.hpp"
 #include "entityx/Event.h"
@@ -19,6 +23,7 @@
 using entityx::EventManager;
 using entityx::Event;
 using entityx::Receiver;
+using entityx::EventReplayer;
 
 
 struct Explosion {
@@ -107,3 +112,586 @@ TEST_CASE("TestUnsubscription") {
     REQUIRE(explosion_system.damage_received == 1);
   }
 }
+
+TEST_CASE("TestEventsWithoutReceiversAreNotConstructed") {
+  struct Counted {
+    explicit Counted(int *constructed) { ++*constructed; }
+  };
+  struct CountedReceiver : public Receiver<CountedReceiver> {
+    void receive(const Counted &counted) {}
+  };
+
+  EventManager em;
+  int constructed = 0;
+  REQUIRE(!em.has_receivers<Counted>());
+  em.emit<Counted>(&constructed);
+  REQUIRE(0 == constructed);
+  {
+    CountedReceiver receiver;
+    em.subscribe<Counted>(receiver);
+    REQUIRE(em.has_receivers<Counted>());
+    em.emit<Counted>(&constructed);
+    REQUIRE(1 == constructed);
+  }
+  REQUIRE(!em.has_receivers<Counted>());
+}
+
+TEST_CASE("TestSubscriptionChangesDuringEmission") {
+  struct OneShot : public Receiver<OneShot> {
+    void receive(const Explosion &explosion) {
+      ++received;
+      em->unsubscribe<Explosion>(*this);
+      em->subscribe<Explosion>(*late);
+    }
+
+    EventManager *em;
+    ExplosionSystem *late;
+    int received = 0;
+  };
+
+  EventManager em;
+  ExplosionSystem before, after, late;
+  OneShot one_shot;
+  one_shot.em = &em;
+  one_shot.late = &late;
+  em.subscribe<Explosion>(before);
+  em.subscribe<Explosion>(one_shot);
+  em.subscribe<Explosion>(after);
+
+  em.emit<Explosion>(1);
+  REQUIRE(1 == before.damage_received);
+  REQUIRE(1 == one_shot.received);
+  REQUIRE(1 == after.damage_received);
+  // Receivers connected during emission only receive later events.
+  REQUIRE(0 == late.damage_received);
+  REQUIRE(3 == em.connected_receivers());
+
+  em.emit<Explosion>(1);
+  REQUIRE(2 == before.damage_received);
+  REQUIRE(1 == one_shot.received);
+  REQUIRE(2 == after.damage_received);
+  REQUIRE(1 == late.damage_received);
+}
+
+TEST_CASE("TestSubscriptionChangesAfterReceiverThrows") {
+  struct Thrower : public Receiver<Thrower> {
+    void receive(const Explosion &explosion) { throw explosion.damage; }
+  };
+
+  EventManager em;
+  Thrower thrower;
+  ExplosionSystem late;
+  em.subscribe<Explosion>(thrower);
+  REQUIRE_THROWS(em.emit<Explosion>(1));
+
+  // The signal is no longer emitting, so changes take effect immediately.
+  em.unsubscribe<Explosion>(thrower);
+  em.subscribe<Explosion>(late);
+  em.emit<Explosion>(1);
+  REQUIRE(1 == late.damage_received);
+  REQUIRE(1 == em.connected_receivers());
+}
+
+TEST_CASE("TestQueuedEvents") {
+  struct BatchReceiver : public Receiver<BatchReceiver> {
+    void receive(const std::vector<Explosion> &explosions) {
+      batches++;
+      for (const Explosion &explosion : explosions) damage_received += explosion.damage;
+      // Queued for the next update, not this one.
+      if (requeue) em->enqueue<Explosion>(100);
+      requeue = false;
+    }
+
+    EventManager *em;
+    bool requeue = true;
+    int batches = 0;
+    int damage_received = 0;
+  };
+
+  EventManager em;
+  BatchReceiver batch;
+  batch.em = &em;
+  ExplosionSystem each;
+  em.subscribe<std::vector<Explosion>>(batch);
+  em.subscribe<Explosion>(each);
+  em.subscribe<Collision>(each);
+
+  em.enqueue<Explosion>(1);
+  em.enqueue(Explosion(2));
+  em.enqueue<Collision>(10);
+  REQUIRE(2 == em.queued<Explosion>());
+  REQUIRE(0 == each.damage_received);
+
+  em.update<Explosion>();
+  REQUIRE(1 == batch.batches);
+  REQUIRE(3 == batch.damage_received);
+  REQUIRE(3 == each.damage_received);
+  REQUIRE(1 == em.queued<Explosion>());
+  REQUIRE(1 == em.queued<Collision>());
+
+  em.update_all();
+  REQUIRE(2 == batch.batches);
+  REQUIRE(103 == batch.damage_received);
+  REQUIRE(113 == each.damage_received);
+  REQUIRE(0 == em.queued<Explosion>());
+  REQUIRE(0 == em.queued<Collision>());
+
+  // Nothing queued, nothing delivered.
+  em.update_all();
+  REQUIRE(2 == batch.batches);
+}
+
+TEST_CASE("TestPostedEvents") {
+  struct Ordered : public Receiver<Ordered> {
+    void receive(const Explosion &explosion) { order.push_back(explosion.damage); }
+
+    std::vector<int> order;
+  };
+
+  EventManager em;
+  Ordered receiver;
+  em.subscribe<Explosion>(receiver);
+
+  const int workers = 4, count = 1000;
+  std::vector<std::thread> threads;
+  for (int worker = 0; worker < workers; worker++) {
+    threads.push_back(std::thread([&em, worker]() {
+      for (int i = 0; i < count; i++) em.post_ordered<Explosion>(worker * count + i, worker * count + i);
+    }));
+  }
+  em.enqueue<Explosion>(-1);
+  for (std::thread &thread : threads) thread.join();
+  REQUIRE(receiver.order.empty());
+
+  em.update<Explosion>();
+  REQUIRE(receiver.order.size() == size_t(workers * count + 1));
+  // Enqueued events come first, then posted events by key.
+  REQUIRE(-1 == receiver.order[0]);
+  for (int i = 0; i < workers * count; i++) REQUIRE(i == receiver.order[i + 1]);
+
+  em.post<Explosion>(7);
+  em.post<Collision>(8);
+  em.update_all();
+  REQUIRE(7 == receiver.order.back());
+  REQUIRE(0 == em.queued<Collision>());
+
+  // Threads keep their own buffer per EventManager, across merges.
+  EventManager other;
+  Ordered other_receiver;
+  other.subscribe<Explosion>(other_receiver);
+  std::thread worker([&em, &other]() {
+    for (int i = 0; i < 3; i++) {
+      em.post<Explosion>(i);
+      other.post<Explosion>(10 + i);
+    }
+  });
+  worker.join();
+  em.post<Explosion>(3);
+  em.update_all();
+  other.update<Explosion>();
+  REQUIRE((std::vector<int>{0, 1, 2, 3} == std::vector<int>(receiver.order.end() - 4, receiver.order.end())));
+  REQUIRE((std::vector<int>{10, 11, 12} == other_receiver.order));
+}
+
+template <int N>
+struct Numbered : public Event<Numbered<N>> {};
+
+TEST_CASE("TestEventFamiliesFirstUsedByWorkers") {
+  std::vector<std::size_t> first, second;
+  std::thread worker([&first]() {
+    first = {Numbered<0>::family(), Numbered<1>::family(), Numbered<2>::family(), Numbered<3>::family()};
+  });
+  second = {Numbered<4>::family(), Numbered<5>::family(), Numbered<6>::family(), Numbered<7>::family()};
+  worker.join();
+  std::set<std::size_t> families(first.begin(), first.end());
+  families.insert(second.begin(), second.end());
+  REQUIRE(8 == families.size());
+}
+
+TEST_CASE("TestPrioritiesAndConsumedEvents") {
+  struct Handler : public Receiver<Handler> {
+    Handler(std::vector<int> *calls, int id, bool consume) : calls(calls), id(id), consume(consume) {}
+
+    bool receive(const Explosion &explosion) {
+      calls->push_back(id);
+      return consume && explosion.damage > 0;
+    }
+
+    std::vector<int> *calls;
+    int id;
+    bool consume;
+  };
+
+  EventManager em;
+  std::vector<int> calls;
+  Handler logger(&calls, 1, false), input(&calls, 2, true), analytics(&calls, 3, false);
+  ExplosionSystem unprioritised;
+  em.subscribe<Explosion>(logger, -10);
+  em.subscribe<Explosion>(unprioritised);
+  em.subscribe<Explosion>(input, 10);
+  em.subscribe<Explosion>(analytics, -10);
+
+  // Not consumed: every receiver, by descending priority.
+  REQUIRE(!em.emit<Explosion>(0));
+  REQUIRE((calls == std::vector<int>{2, 1, 3}));
+  REQUIRE(0 == unprioritised.damage_received);
+
+  // Consumed by the highest priority receiver.
+  calls.clear();
+  REQUIRE(em.emit<Explosion>(5));
+  REQUIRE((calls == std::vector<int>{2}));
+  REQUIRE(0 == unprioritised.damage_received);
+
+  em.unsubscribe<Explosion>(input);
+  calls.clear();
+  REQUIRE(!em.emit<Explosion>(5));
+  REQUIRE((calls == std::vector<int>{1, 3}));
+  REQUIRE(5 == unprioritised.damage_received);
+}
+
+TEST_CASE("TestTargetedEvents") {
+  EventManager em;
+  ExplosionSystem first, second, everyone;
+  em.subscribe_to<Explosion>(1, first);
+  em.subscribe_to<Explosion>(2, second);
+  em.subscribe<Explosion>(everyone);
+  REQUIRE(3 == em.connected_receivers());
+
+  em.emit_to<Explosion>(1, 10);
+  em.emit_to<Explosion>(2, 20);
+  em.emit_to<Explosion>(3, 30);
+  REQUIRE(10 == first.damage_received);
+  REQUIRE(20 == second.damage_received);
+  // Targeted events are not broadcast.
+  REQUIRE(0 == everyone.damage_received);
+
+  em.emit<Explosion>(5);
+  REQUIRE(10 == first.damage_received);
+  REQUIRE(5 == everyone.damage_received);
+
+  em.unsubscribe_from<Explosion>(1, first);
+  em.emit_to<Explosion>(1, 10);
+  REQUIRE(10 == first.damage_received);
+  REQUIRE(2 == em.connected_receivers());
+
+  {
+    ExplosionSystem temporary;
+    em.subscribe_to<Explosion>(4, temporary);
+    em.subscribe_to<Collision>(4, temporary);
+    REQUIRE(2 == temporary.connected_signals());
+  }
+  em.emit_to<Explosion>(4, 10);
+  REQUIRE(2 == em.connected_receivers());
+}
+
+TEST_CASE("TestTargetSignalsReleased") {
+  struct SelfDestruct : public Receiver<SelfDestruct> {
+    void receive(const Explosion &explosion) { owner.reset(); }
+
+    std::unique_ptr<SelfDestruct> owner;
+  };
+
+  EventManager em;
+  ExplosionSystem stays;
+  em.subscribe_to<Explosion>(0, stays);
+  // Destroyed receivers don't leave their targets behind.
+  for (std::uint64_t target = 1; target <= 1000; target++) {
+    ExplosionSystem temporary;
+    em.subscribe_to<Explosion>(target, temporary);
+  }
+  REQUIRE(1 == em.subscribed_targets<Explosion>());
+
+  ExplosionSystem unsubscribed;
+  em.subscribe_to<Explosion>(1, unsubscribed);
+  em.unsubscribe_from<Explosion>(1, unsubscribed);
+  REQUIRE(1 == em.subscribed_targets<Explosion>());
+
+  // Nor do receivers destroyed during emission.
+  SelfDestruct *receiver = new SelfDestruct();
+  receiver->owner.reset(receiver);
+  em.subscribe_to<Explosion>(2, *receiver);
+  REQUIRE(2 == em.subscribed_targets<Explosion>());
+  em.emit_to<Explosion>(2, 10);
+  REQUIRE(1 == em.subscribed_targets<Explosion>());
+}
+
+TEST_CASE("TestFrameArena") {
+  struct Sound {
+    Sound(const float *samples, std::size_t count) : samples(samples), count(count) {}
+
+    const float *samples;
+    std::size_t count;
+  };
+  struct Mixer : public Receiver<Mixer> {
+    void receive(const Sound &sound) {
+      for (std::size_t i = 0; i < sound.count; i++) total += sound.samples[i];
+    }
+
+    float total = 0;
+  };
+
+  EventManager em;
+  Mixer mixer;
+  em.subscribe<Sound>(mixer);
+  std::vector<float> samples = {1, 2, 3};
+  em.enqueue<Sound>(em.frame_arena().copy(samples.data(), samples.size()), samples.size());
+  // The payload belongs to the arena, not the caller.
+  samples.assign(3, 0);
+  em.update_all();
+  REQUIRE(6 == mixer.total);
+  REQUIRE(em.frame_arena().used() > 0);
+  em.end_frame();
+  REQUIRE(0 == em.frame_arena().used());
+}
+
+TEST_CASE("TestEventStats") {
+  EventManager em;
+  ExplosionSystem receiver, other;
+  em.subscribe<Explosion>(receiver);
+  em.subscribe<Explosion>(other);
+  em.start_trace();
+  em.emit<Explosion>(1);
+  em.emit<Explosion>(2);
+  em.emit<Collision>(3);
+  em.stop_trace();
+  em.emit<Explosion>(3);
+
+  std::ostringstream stats, trace;
+  em.write_stats(stats);
+  em.write_trace(trace);
+  if (!entityx::EVENT_STATS) {
+    REQUIRE(em.stats().empty());
+    REQUIRE(stats.str() == "{\"events\": [\n]}\n");
+    return;
+  }
+  const entityx::EventStats &explosions = em.stats()[Event<Explosion>::family()];
+  REQUIRE(3 == explosions.emits);
+  REQUIRE(6 == explosions.receivers);
+  REQUIRE(explosions.percentile(0.5) > 0);
+  REQUIRE(explosions.percentile(0.5) <= explosions.percentile(1.0));
+  // Collision had no receivers, but its emit is still counted.
+  REQUIRE(stats.str().find("\"name\": \"Explosion\", \"emits\": 3, \"receivers\": 6") != std::string::npos);
+  REQUIRE(stats.str().find("\"name\": \"Collision\", \"emits\": 1, \"receivers\": 0") != std::string::npos);
+  REQUIRE(trace.str().find("Collision") != std::string::npos);
+  REQUIRE(trace.str().find("\"traceEvents\"") == 1);
+  // Only the two dispatches while tracing.
+  std::string traced = trace.str();
+  REQUIRE(traced.find("Explosion") != std::string::npos);
+  REQUIRE(traced.find("Explosion") != traced.rfind("Explosion"));
+  REQUIRE(traced.find("Explosion", traced.find("Explosion") + 1) == traced.rfind("Explosion"));
+
+  em.reset_stats();
+  REQUIRE(0 == em.stats()[Event<Explosion>::family()].emits);
+}
+
+TEST_CASE("TestRecordAndReplayEvents") {
+  struct Chain : public Receiver<Chain> {
+    // Events emitted while handling another are not recorded.
+    void receive(const Explosion &explosion) { em->emit<Collision>(explosion.damage); }
+
+    EventManager *em;
+  };
+
+  std::stringstream recording;
+  {
+    EventManager em;
+    em.register_event<Explosion>(1);
+    em.register_event<Collision>(2);
+    Chain chain;
+    chain.em = &em;
+    ExplosionSystem receiver;
+    em.subscribe<Explosion>(chain);
+    em.subscribe<Collision>(receiver);
+    em.emit<Collision>(1);
+    em.start_recording(recording);
+    em.emit<Explosion>(2);
+    em.emit<Collision>(3);
+    em.end_frame();
+    em.emit<Explosion>(4);
+    em.end_frame();
+    em.stop_recording();
+    em.emit<Explosion>(5);
+  }
+
+  // Replayed into a manager whose event families are numbered differently.
+  EventManager em;
+  struct Unrelated {};
+  em.register_event<Unrelated>(3);
+  em.register_event<Collision>(2);
+  em.register_event<Explosion>(1);
+  ExplosionSystem explosions, collisions;
+  em.subscribe<Explosion>(explosions);
+  em.subscribe<Collision>(collisions);
+
+  EventReplayer replayer(recording);
+  REQUIRE(replayer.valid());
+  REQUIRE(replayer.replay_frame(em));
+  REQUIRE(2 == explosions.damage_received);
+  REQUIRE(3 == collisions.damage_received);
+  REQUIRE(replayer.replay_frame(em));
+  REQUIRE(6 == explosions.damage_received);
+  REQUIRE(!replayer.replay_frame(em));
+
+  replayer.rewind();
+  REQUIRE(3 == replayer.replay(em));
+  REQUIRE(12 == explosions.damage_received);
+
+  std::stringstream garbage("not a recording");
+  REQUIRE(!EventReplayer(garbage).valid());
+}
+
+TEST_CASE("TestRecordTargetedAndUnreceivedEvents") {
+  struct Batch : public Receiver<Batch> {
+    bool receive(const std::vector<Explosion> &explosions) { return true; }
+  };
+
+  std::stringstream recording;
+  {
+    EventManager em;
+    em.register_event<Explosion>(1);
+    Batch batch;
+    em.subscribe<std::vector<Explosion>>(batch);
+    em.start_recording(recording);
+    // None of these reach an Explosion receiver, but all are recorded.
+    em.emit_to<Explosion>(7, 10);
+    em.emit<Explosion>(3);
+    em.enqueue<Explosion>(5);
+    em.update<Explosion>();
+    em.stop_recording();
+  }
+
+  EventManager em;
+  em.register_event<Explosion>(1);
+  ExplosionSystem target, everyone;
+  em.subscribe_to<Explosion>(7, target);
+  em.subscribe<Explosion>(everyone);
+  EventReplayer replayer(recording);
+  // The recording ends without completing a frame.
+  REQUIRE(!replayer.replay_frame(em));
+  REQUIRE(10 == target.damage_received);
+  REQUIRE(8 == everyone.damage_received);
+}
+
+TEST_CASE("TestSubscribeMemberFunctions") {
+  struct Handlers : public Receiver<Handlers> {
+    void on_explosion(const Explosion &explosion) { explosions += explosion.damage; }
+    void log_explosion(const Explosion &explosion) { logged++; }
+    bool absorb_collision(const Collision &collision) { return true; }
+
+    int explosions = 0;
+    int logged = 0;
+  };
+
+  EventManager em;
+  Handlers handlers;
+  ExplosionSystem after;
+  em.subscribe<Explosion, Handlers, &Handlers::on_explosion>(handlers);
+  em.subscribe<Explosion, Handlers, &Handlers::log_explosion>(handlers);
+  em.subscribe<Collision, Handlers, &Handlers::absorb_collision>(handlers, 1);
+  em.subscribe<Collision>(after);
+  REQUIRE(3 == handlers.connected_signals());
+
+  em.emit<Explosion>(5);
+  REQUIRE(5 == handlers.explosions);
+  REQUIRE(1 == handlers.logged);
+  REQUIRE(em.emit<Collision>(5));
+  REQUIRE(0 == after.damage_received);
+
+  // Unsubscribing removes every delegate of the receiver for the event type.
+  em.unsubscribe<Explosion>(handlers);
+  em.emit<Explosion>(5);
+  REQUIRE(5 == handlers.explosions);
+  REQUIRE(1 == handlers.connected_signals());
+
+  entityx::Delegate delegate = entityx::Delegate::bind<Explosion, Handlers, &Handlers::on_explosion>(handlers);
+  Explosion explosion(2);
+  REQUIRE(!delegate(&explosion));
+  REQUIRE(7 == handlers.explosions);
+}
+
+TEST_CASE("TestSubscriptionChurn") {
+  EventManager em;
+  std::vector<std::unique_ptr<ExplosionSystem>> receivers;
+  for (int i = 0; i < 100; i++) {
+    receivers.emplace_back(new ExplosionSystem());
+    em.subscribe<Explosion>(*receivers.back(), i % 3);
+  }
+  // Remove every other receiver, some by destruction.
+  for (int i = 0; i < 100; i += 2) {
+    if (i % 4) {
+      em.unsubscribe<Explosion>(*receivers[i]);
+    } else {
+      receivers[i].reset();
+    }
+  }
+  REQUIRE(50 == em.connected_receivers());
+  // Reuses the freed connection handles.
+  ExplosionSystem many;
+  em.subscribe<Explosion>(many);
+  em.subscribe<Collision>(many);
+  em.subscribe_to<Explosion>(1, many);
+  em.subscribe_to<Explosion>(2, many);
+  REQUIRE(4 == many.connected_signals());
+  em.emit<Explosion>(1);
+  for (int i = 0; i < 100; i++) {
+    if (i % 2) REQUIRE(1 == receivers[i]->damage_received);
+    else if (receivers[i]) REQUIRE(0 == receivers[i]->damage_received);
+  }
+  REQUIRE(1 == many.damage_received);
+
+  receivers.clear();
+  em.unsubscribe_from<Explosion>(1, many);
+  REQUIRE(3 == em.connected_receivers());
+  em.emit<Explosion>(1);
+  em.emit_to<Explosion>(2, 1);
+  REQUIRE(3 == many.damage_received);
+}
+
+TEST_CASE("TestReceiversCopyWithoutSubscriptions") {
+  EventManager em;
+  ExplosionSystem original;
+  em.subscribe<Explosion>(original);
+  em.emit<Explosion>(1);
+
+  ExplosionSystem copy(original);
+  REQUIRE(1 == copy.damage_received);
+  REQUIRE(0 == copy.connected_signals());
+  std::vector<ExplosionSystem> moved;
+  moved.push_back(std::move(copy));
+  em.emit<Explosion>(2);
+  REQUIRE(3 == original.damage_received);
+  REQUIRE(1 == moved[0].damage_received);
+
+  // Destroying copies leaves the original subscribed.
+  moved.clear();
+  em.emit<Explosion>(4);
+  REQUIRE(7 == original.damage_received);
+  REQUIRE(1 == em.connected_receivers());
+}
+
+TEST_CASE("TestEventStreams") {
+  EventManager em;
+  entityx::EventStream<Collision> &collisions = em.stream<Collision>();
+  REQUIRE(&collisions == &em.stream<Collision>());
+
+  collisions.push(1);
+  collisions.push(Collision(2));
+  // Not readable until the end of the frame.
+  REQUIRE(collisions.empty());
+  REQUIRE(2 == collisions.pending());
+
+  em.end_frame();
+  collisions.push(3);
+  // Any number of readers see the previous frame's events.
+  for (int reader = 0; reader < 2; reader++) {
+    int damage = 0;
+    for (const Collision &collision : em.stream<Collision>()) damage += collision.damage;
+    REQUIRE(3 == damage);
+  }
+
+  em.end_frame();
+  REQUIRE(1 == collisions.size());
+  REQUIRE(3 == collisions.events()[0].damage);
+  em.end_frame();
+  REQUIRE(collisions.empty());
+}
@@ -27,6 +27,7 @@ void SystemManager::update_all(TimeDelta dt) {
 void SystemManager::configure() {
   for (auto &pair : systems_) {
     pair.second->configure(event_manager_);
+    pair.second->configure_entities(entity_manager_);
   }
   initialized_ = true;
 }
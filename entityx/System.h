@@ -43,6 +43,12 @@ class BaseSystem : entityx::help::NonCopyable {
    */
   virtual void configure(EventManager &events) {}
 
+  /**
+   * Called after configure(EventManager&), for Systems that also need to set
+   * up EntityManager hooks.
+   */
+  virtual void configure_entities(EntityManager &entities) {}
+
   /**
    * Apply System behavior.
    *
@@ -23,21 +23,68 @@ namespace deps {
  * and `Direction` components:
  *
  *     system_manager->add<Dependency<Physics, Position, Direction>>();
+ *
+ * Dependencies known at compile time are better declared by specialising
+ * entityx::Requires, which the EntityManager resolves without hooks.
  */
 template <typename C, typename ... Deps>
 class Dependency : public System<Dependency<C, Deps...>>, public Receiver<Dependency<C, Deps...>> {
 public:
+  virtual ~Dependency() {
+    if (entities_) entities_->remove_hooks<C>(this);
+  }
+
   void receive(const ComponentAddedEvent<C> &event) {
     assign<Deps...>(event.entity);
   }
 
+  // A Dependency configured by hand with only an EventManager assigns
+  // dependencies from ComponentAddedEvent<C>, which requires
+  // ENTITYX_LIFECYCLE_EVENTS.
   virtual void configure(EventManager &events) override {
+    events_ = &events;
     events.subscribe<ComponentAddedEvent<C>>(*this);
   }
 
+  // Dependencies are assigned from an EntityManager hook, rather than a
+  // ComponentAddedEvent<C> receiver, to avoid event dispatch on every assign.
+  // Batches from assign_many() are assigned their dependencies in bulk.
+  virtual void configure_entities(EntityManager &entities) override {
+    if (events_) {
+      events_->unsubscribe<ComponentAddedEvent<C>>(*this);
+      events_ = nullptr;
+    }
+    entities_ = &entities;
+    entities.on_construct<C>(&Dependency::on_construct, &Dependency::on_construct_many, this);
+  }
+
   virtual void update(EntityManager &entities, EventManager &events, TimeDelta dt) override {}
 
 private:
+  static void on_construct(void *context, Entity entity) {
+    static_cast<Dependency*>(context)->assign<Deps...>(entity);
+  }
+
+  static void on_construct_many(void *context, EntityManager &entities, const std::vector<Entity::Id> &ids) {
+    static_cast<Dependency*>(context)->assign_many<Deps...>(entities, ids);
+  }
+
+  template <typename D>
+  void assign_many(EntityManager &entities, const std::vector<Entity::Id> &ids) {
+    std::vector<Entity::Id> missing;
+    missing.reserve(ids.size());
+    for (Entity::Id id : ids) {
+      if (!entities.has_component<D>(id)) missing.push_back(id);
+    }
+    if (!missing.empty()) entities.assign_many<D>(missing);
+  }
+
+  template <typename D, typename D1, typename ... Ds>
+  void assign_many(EntityManager &entities, const std::vector<Entity::Id> &ids) {
+    assign_many<D>(entities, ids);
+    assign_many<D1, Ds...>(entities, ids);
+  }
+
   template <typename D>
   void assign(Entity entity) {
     if (!entity.component<D>()) entity.assign<D>();
@@ -48,6 +95,9 @@ private:
     assign<D>(entity);
     assign<D1, Ds...>(entity);
   }
+
+  EventManager *events_ = nullptr;
+  EntityManager *entities_ = nullptr;
 };
 
 }  // namespace deps
@@ -62,3 +62,32 @@ TEST_CASE_METHOD(entityx::EntityX, "TestDependencyDoesNotRecreateComponent") {
   e.assign<A>();
   REQUIRE(e.component<B>()->b);
 }
+
+TEST_CASE_METHOD(entityx::EntityX, "TestDependenciesOfBatches") {
+  systems.add<deps::Dependency<A, B>>();
+  systems.add<deps::Dependency<B, C>>();
+  systems.configure();
+
+  std::vector<entityx::Entity::Id> ids;
+  for (int i = 0; i < 10; i++) ids.push_back(entities.create().id());
+  entities.assign<B>(ids[3], true);
+  entities.assign_many<A>(ids);
+  for (entityx::Entity::Id id : ids) {
+    entityx::Entity e = entities.get(id);
+    REQUIRE(static_cast<bool>(e.component<A>()));
+    REQUIRE(static_cast<bool>(e.component<B>()));
+    REQUIRE(static_cast<bool>(e.component<C>()));
+  }
+  REQUIRE(entities.get(ids[3]).component<B>()->b);
+}
+
+#if ENTITYX_LIFECYCLE_EVENTS
+TEST_CASE_METHOD(entityx::EntityX, "TestDependencyConfiguredWithEvents") {
+  deps::Dependency<A, B> dependency;
+  dependency.configure(events);
+
+  entityx::Entity e = entities.create();
+  e.assign<A>();
+  REQUIRE(static_cast<bool>(e.component<B>()));
+}
+#endif
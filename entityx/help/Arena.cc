@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2012-2014 Alec Thomas <alec@swapoff.org>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: Alec Thomas <alec@swapoff.org>
+ */
+
+#include "entityx/help/Arena.h"
+
+namespace entityx {
+
+Arena::~Arena() {
+  reset();
+  for (char *block : blocks_) delete[] block;
+}
+
+void Arena::reset() {
+  for (Finalizer *finalizer = finalizers_; finalizer; finalizer = finalizer->next) {
+    finalizer->destroy(finalizer->object);
+  }
+  finalizers_ = nullptr;
+  for (char *allocation : large_) delete[] allocation;
+  large_.clear();
+  block_ = 0;
+  offset_ = 0;
+  used_ = 0;
+}
+
+void *Arena::allocate_slow(std::size_t size, std::size_t alignment) {
+  if (size + alignment > block_size_) {
+    char *allocation = new char[size + alignment];
+    large_.push_back(allocation);
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(allocation);
+    used_ += size;
+    return reinterpret_cast<void*>((base + alignment - 1) & ~std::uintptr_t(alignment - 1));
+  }
+  // The current block is exhausted; start the next one.
+  if (block_ < blocks_.size()) block_++;
+  if (block_ == blocks_.size()) blocks_.push_back(new char[block_size_]);
+  offset_ = 0;
+  return allocate(size, alignment);
+}
+
+}  // namespace entityx
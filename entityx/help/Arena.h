@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2012-2014 Alec Thomas <alec@swapoff.org>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: Alec Thomas <alec@swapoff.org>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "entityx/help/NonCopyable.h"
+
+namespace entityx {
+
+/**
+ * A bump allocator for short lived objects, typically those that live for a
+ * frame.
+ *
+ * Allocation advances a pointer through fixed size blocks. Nothing is freed
+ * individually: reset() destroys every object created since the last reset
+ * and releases their memory at once, keeping the blocks for reuse.
+ *
+ * Pointers into the arena are invalidated by reset().
+ */
+class Arena : entityx::help::NonCopyable {
+ public:
+  explicit Arena(std::size_t block_size = 64 * 1024) : block_size_(block_size) {}
+  ~Arena();
+
+  /// Allocate uninitialised memory.
+  void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+    if (block_ < blocks_.size()) {
+      std::uintptr_t base = reinterpret_cast<std::uintptr_t>(blocks_[block_]);
+      std::uintptr_t address = (base + offset_ + alignment - 1) & ~std::uintptr_t(alignment - 1);
+      if (address + size <= base + block_size_) {
+        offset_ = address + size - base;
+        used_ += size;
+        return reinterpret_cast<void*>(address);
+      }
+    }
+    return allocate_slow(size, alignment);
+  }
+
+  /// Construct an object in the arena. Its destructor is called by reset().
+  template <typename T, typename ... Args>
+  T *create(Args && ... args) {
+    T *object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args) ...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Finalizer *finalizer = new(allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer;
+      finalizer->destroy = &Arena::destroy<T>;
+      finalizer->object = object;
+      finalizer->next = finalizers_;
+      finalizers_ = finalizer;
+    }
+    return object;
+  }
+
+  /// Copy an array of trivially copyable elements into the arena.
+  template <typename T>
+  T *copy(const T *data, std::size_t n) {
+    static_assert(std::is_trivially_copyable<T>::value, "Arena::copy() requires trivially copyable elements");
+    T *copied = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+    if (n) std::memcpy(copied, data, sizeof(T) * n);
+    return copied;
+  }
+
+  /// Destroy all objects and release all allocations.
+  void reset();
+
+  /// Bytes allocated since the last reset().
+  std::size_t used() const { return used_; }
+  /// Bytes held in blocks, which are retained across reset().
+  std::size_t capacity() const { return blocks_.size() * block_size_; }
+
+ private:
+  struct Finalizer {
+    void (*destroy)(void *object);
+    void *object;
+    Finalizer *next;
+  };
+
+  template <typename T>
+  static void destroy(void *object) {
+    static_cast<T*>(object)->~T();
+  }
+
+  // Moves on to the next block, or allocates oversized requests separately.
+  void *allocate_slow(std::size_t size, std::size_t alignment);
+
+  std::size_t block_size_;
+  std::vector<char*> blocks_;
+  // Allocations too large for a block, freed by reset().
+  std::vector<char*> large_;
+  std::size_t block_ = 0;
+  std::size_t offset_ = 0;
+  std::size_t used_ = 0;
+  Finalizer *finalizers_ = nullptr;
+};
+
+}  // namespace entityx
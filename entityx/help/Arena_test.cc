@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012-2014 Alec Thomas <alec@swapoff.org>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: Alec Thomas <alec@swapoff.org>
+ */
+
+#define CATCH_CONFIG_MAIN
+
+#include <cstdint>
+#include <string>
+#include "entityx/3rdparty/catch.hpp"
+#include "entityx/help/Arena.h"
+
+struct Counted {
+  explicit Counted(int *destroyed) : destroyed(destroyed) {}
+  ~Counted() { (*destroyed)++; }
+
+  int *destroyed;
+};
+
+struct alignas(64) Aligned {
+  char data[64];
+};
+
+
+TEST_CASE("TestArenaAllocate") {
+  entityx::Arena arena(256);
+  REQUIRE(0 == arena.capacity());
+  int *a = arena.create<int>(1);
+  int *b = arena.create<int>(2);
+  REQUIRE(1 == *a);
+  REQUIRE(2 == *b);
+  REQUIRE(256 == arena.capacity());
+
+  Aligned *aligned = arena.create<Aligned>();
+  REQUIRE(0 == reinterpret_cast<std::uintptr_t>(aligned) % 64);
+
+  // Spills into a second block.
+  for (int i = 0; i < 64; i++) arena.create<int>(i);
+  REQUIRE(512 == arena.capacity());
+
+  // Larger than a block.
+  char *large = static_cast<char*>(arena.allocate(1024));
+  large[1023] = 'x';
+  REQUIRE(512 == arena.capacity());
+
+  const char text[] = "hello";
+  const char *copied = arena.copy(text, sizeof(text));
+  REQUIRE(std::string("hello") == copied);
+}
+
+TEST_CASE("TestArenaReset") {
+  entityx::Arena arena(256);
+  int destroyed = 0;
+  arena.create<Counted>(&destroyed);
+  arena.create<Counted>(&destroyed);
+  arena.create<std::string>("not trivially destructible, and longer than the small string buffer");
+  for (int i = 0; i < 100; i++) arena.create<int>(i);
+  std::size_t capacity = arena.capacity();
+  REQUIRE(arena.used() > 0);
+
+  arena.reset();
+  REQUIRE(2 == destroyed);
+  REQUIRE(0 == arena.used());
+  // Blocks are kept for reuse.
+  REQUIRE(capacity == arena.capacity());
+  for (int i = 0; i < 100; i++) arena.create<int>(i);
+  REQUIRE(capacity == arena.capacity());
+}
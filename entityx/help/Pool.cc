@@ -18,4 +18,6 @@ BasePool::~BasePool() {
   }
 }
 
+constexpr std::size_t ChangeTicks::CHUNK_SIZE;
+
 }  // namespace entityx
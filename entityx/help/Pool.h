@@ -10,16 +10,27 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include "entityx/config.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace entityx {
 
 /**
  * Provides a resizable, semi-contiguous pool of memory for constructing
  * objects in. Pointers into the pool will be invalided only when the pool is
- * destroyed.
+ * destroyed (but see ContiguousPool).
  *
  * The semi-contiguous nature aims to provide cache-friendly iteration.
  *
@@ -36,15 +47,24 @@ class BasePool {
   std::size_t capacity() const { return capacity_; }
   std::size_t chunks() const { return blocks_.size(); }
 
+  /// Number of chunks that have actually been allocated (see resize()).
+  std::size_t allocated_chunks() const {
+    return blocks_.size() - std::count(blocks_.begin(), blocks_.end(), nullptr);
+  }
+
   /// Ensure at least n elements will fit in the pool.
   inline void expand(std::size_t n) {
     if (n >= size_) {
-      if (n >= capacity_) reserve(n);
+      reserve(n);
       size_ = n;
     }
   }
 
-  inline void reserve(std::size_t n) {
+  virtual void reserve(std::size_t n) {
+    // Allocate any chunks deferred by resize().
+    for (std::size_t i = 0; i < blocks_.size() && i * chunk_size_ < n; i++) {
+      if (!blocks_[i]) blocks_[i] = new char[element_size_ * chunk_size_];
+    }
     while (capacity_ < n) {
       char *chunk = new char[element_size_ * chunk_size_];
       blocks_.push_back(chunk);
@@ -52,6 +72,30 @@ class BasePool {
     }
   }
 
+  /**
+   * Grow the pool to n elements without allocating chunks for them.
+   *
+   * Chunks are allocated on demand by allocate(), so sparsely populated
+   * pools only pay for the chunks that are actually in use.
+   */
+  virtual void resize(std::size_t n) {
+    if (n >= size_) {
+      while (capacity_ < n) {
+        blocks_.push_back(nullptr);
+        capacity_ += chunk_size_;
+      }
+      size_ = n;
+    }
+  }
+
+  /// Return storage for element n, allocating its chunk if necessary.
+  inline void *allocate(std::size_t n) {
+    assert(n < size_);
+    char *&chunk = blocks_[n / chunk_size_];
+    if (!chunk) chunk = new char[element_size_ * chunk_size_];
+    return chunk + (n % chunk_size_) * element_size_;
+  }
+
   inline void *get(std::size_t n) {
     assert(n < size_);
     return blocks_[n / chunk_size_] + (n % chunk_size_) * element_size_;
@@ -64,6 +108,12 @@ class BasePool {
 
   virtual void destroy(std::size_t n) = 0;
 
+  /**
+   * Move each constructed element from[k] to to[k], in one pass. Elements of
+   * from that are not also in to are left unconstructed.
+   */
+  virtual void relocate(const std::vector<std::uint32_t> &from, const std::vector<std::uint32_t> &to) = 0;
+
  protected:
   std::vector<char *> blocks_;
   std::size_t element_size_;
@@ -73,23 +123,436 @@ class BasePool {
 };
 
 
+/**
+ * Type-aware element operations shared by all typed pools.
+ */
+template <typename T>
+class TypedPool : public BasePool {
+ public:
+  explicit TypedPool(std::size_t chunk_size) : BasePool(sizeof(T), chunk_size) {}
+
+  virtual void destroy(std::size_t n) override {
+    assert(n < size_);
+    T *ptr = static_cast<T*>(get(n));
+    ptr->~T();
+  }
+
+  virtual void relocate(const std::vector<std::uint32_t> &from, const std::vector<std::uint32_t> &to) override {
+    assert(from.size() == to.size());
+    // Gathered into a buffer, then scattered to their destinations.
+    T *buffer = static_cast<T*>(::operator new(from.size() * sizeof(T)));
+    for (std::size_t k = 0; k < from.size(); k++) {
+      T *src = static_cast<T*>(get(from[k]));
+      new(buffer + k) T(std::move(*src));
+      src->~T();
+    }
+    for (std::size_t k = 0; k < to.size(); k++) {
+      new(allocate(to[k])) T(std::move(buffer[k]));
+      buffer[k].~T();
+    }
+    ::operator delete(buffer);
+  }
+};
+
+
 /**
  * Implementation of BasePool that provides type-"safe" deconstruction of
  * elements in the pool.
  */
 template <typename T, std::size_t ChunkSize = 8192>
-class Pool : public BasePool {
+class Pool : public TypedPool<T> {
  public:
-  Pool() : BasePool(sizeof(T), ChunkSize) {}
+  static_assert(ChunkSize > 0, "ChunkSize must be non-zero");
+
+  Pool() : TypedPool<T>(ChunkSize) {}
   virtual ~Pool() {
     // Component destructors *must* be called by owner.
   }
 
+  // Shadows BasePool::get() so that the chunk arithmetic is done with a
+  // compile-time constant.
+  inline void *get(std::size_t n) {
+    assert(n < this->size_);
+    return this->blocks_[n / ChunkSize] + (n % ChunkSize) * sizeof(T);
+  }
+
+  inline const void *get(std::size_t n) const {
+    assert(n < this->size_);
+    return this->blocks_[n / ChunkSize] + (n % ChunkSize) * sizeof(T);
+  }
+};
+
+
+/**
+ * Number of elements of T per chunk such that a chunk occupies at most Bytes,
+ * rounded down to a power of two so chunk arithmetic reduces to shifts.
+ *
+ * eg. to allocate Inventory components in 64KB chunks:
+ *
+ *     Pool<Inventory, ChunkSizeFor<Inventory, 65536>::value>
+ */
+template <typename T, std::size_t Bytes>
+struct ChunkSizeFor {
+ private:
+  static constexpr std::size_t floor_pow2(std::size_t n, std::size_t p = 1) {
+    return p * 2 > n ? p : floor_pow2(n, p * 2);
+  }
+
+ public:
+  static constexpr std::size_t value = sizeof(T) >= Bytes ? 1 : floor_pow2(Bytes / sizeof(T));
+};
+
+template <typename T, std::size_t Bytes>
+constexpr std::size_t ChunkSizeFor<T, Bytes>::value;
+
+
+/**
+ * A pool backed by a single contiguous buffer, ie. one chunk that is
+ * reallocated as the pool grows.
+ *
+ * Lookups are a single multiply-add and iterating over the whole pool is one
+ * linear stream. The trade-off is that growing the pool relocates every
+ * element, so pointers into the pool are invalidated whenever it grows. T
+ * must therefore be trivially copyable.
+ */
+template <typename T>
+class ContiguousPool : public TypedPool<T> {
+ public:
+  ContiguousPool() : TypedPool<T>(0) {}
+  virtual ~ContiguousPool() {
+    // Allocated with realloc(), so release it here rather than in ~BasePool().
+    std::free(data_);
+    this->blocks_.clear();
+  }
+
+  inline void *get(std::size_t n) {
+    assert(n < this->size_);
+    return data_ + n;
+  }
+
+  inline const void *get(std::size_t n) const {
+    assert(n < this->size_);
+    return data_ + n;
+  }
+
+  virtual void resize(std::size_t n) override {
+    this->expand(n);
+  }
+
+  virtual void reserve(std::size_t n) override {
+    if (n <= this->capacity_) return;
+    std::size_t capacity = std::max<std::size_t>(this->capacity_ * 2, 64);
+    while (capacity < n) capacity *= 2;
+    T *data = static_cast<T*>(std::realloc(data_, capacity * sizeof(T)));
+    if (!data) throw std::bad_alloc();
+    data_ = data;
+    this->blocks_.assign(1, reinterpret_cast<char*>(data_));
+    // BasePool::get() stays valid by treating the buffer as a single chunk.
+    this->chunk_size_ = this->capacity_ = capacity;
+  }
+
+ private:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ContiguousPool relocates elements when growing, so T must be trivially copyable");
+
+  T *data_ = nullptr;
+};
+
+
+/**
+ * Untyped base of PackedPool: maps element indices to positions in a dense
+ * array, and back.
+ */
+class BasePackedPool : public BasePool {
+ public:
+  explicit BasePackedPool(std::size_t element_size) : BasePool(element_size, 1) {}
+
+  /// Number of constructed elements. They occupy positions [0, count()).
+  std::size_t count() const { return packed_.size(); }
+
+  /// Position of constructed element n.
+  inline std::size_t position(std::size_t n) const {
+    assert(n < size_);
+    return sparse_[n];
+  }
+
+  /// Element stored at position p.
+  inline std::size_t element(std::size_t p) const { return packed_[p]; }
+
+  virtual void reserve(std::size_t n) override {
+    if (n > capacity_) {
+      sparse_.resize(n);
+      capacity_ = n;
+    }
+  }
+
+  virtual void resize(std::size_t n) override {
+    this->expand(n);
+  }
+
+  // Relocating elements only relabels their positions.
+  virtual void relocate(const std::vector<std::uint32_t> &from, const std::vector<std::uint32_t> &to) override {
+    assert(from.size() == to.size());
+    std::vector<std::uint32_t> positions(from.size());
+    for (std::size_t k = 0; k < from.size(); k++) positions[k] = sparse_[from[k]];
+    for (std::size_t k = 0; k < to.size(); k++) {
+      sparse_[to[k]] = positions[k];
+      packed_[positions[k]] = to[k];
+    }
+  }
+
+  /// Exchange the elements at positions a and b.
+  virtual void swap_positions(std::size_t a, std::size_t b) = 0;
+
+ protected:
+  // Position of each element, indexed by element.
+  std::vector<std::uint32_t> sparse_;
+  // Element at each position.
+  std::vector<std::uint32_t> packed_;
+};
+
+
+/**
+ * A pool that keeps its elements packed at the front of a single buffer, in
+ * no particular order, with an index from elements to their positions.
+ *
+ * Lookups cost one extra indirection, but iterating over the elements visits
+ * only constructed ones, and their order can be controlled with
+ * swap_positions() (see EntityManager::owning_group()). Destroying an element
+ * moves the last one into its place, and growing the buffer relocates every
+ * element, so pointers into the pool are invalidated by both.
+ *
+ * BasePool::get() must not be used.
+ */
+template <typename T>
+class PackedPool : public BasePackedPool {
+ public:
+  PackedPool() : BasePackedPool(sizeof(T)) {}
+  virtual ~PackedPool() {
+    // Component destructors *must* be called by owner.
+    ::operator delete(data_);
+  }
+
+  inline void *get(std::size_t n) {
+    assert(n < size_);
+    return data_ + sparse_[n];
+  }
+
+  inline const void *get(std::size_t n) const {
+    assert(n < size_);
+    return data_ + sparse_[n];
+  }
+
+  /// Return storage for element n at the end of the buffer.
+  inline void *allocate(std::size_t n) {
+    assert(n < size_);
+    if (packed_.size() == storage_) grow();
+    sparse_[n] = std::uint32_t(packed_.size());
+    packed_.push_back(std::uint32_t(n));
+    return data_ + sparse_[n];
+  }
+
+  /// The packed elements, in position order.
+  T *data() { return data_; }
+  const T *data() const { return data_; }
+
   virtual void destroy(std::size_t n) override {
     assert(n < size_);
-    T *ptr = static_cast<T*>(get(n));
-    ptr->~T();
+    std::size_t position = sparse_[n], last = packed_.size() - 1;
+    data_[position].~T();
+    if (position != last) {
+      new(data_ + position) T(std::move(data_[last]));
+      data_[last].~T();
+      packed_[position] = packed_[last];
+      sparse_[packed_[position]] = std::uint32_t(position);
+    }
+    packed_.pop_back();
+  }
+
+  virtual void swap_positions(std::size_t a, std::size_t b) override {
+    if (a == b) return;
+    // Components are not required to be assignable, so swap by reconstruction.
+    T tmp(std::move(data_[a]));
+    data_[a].~T();
+    new(data_ + a) T(std::move(data_[b]));
+    data_[b].~T();
+    new(data_ + b) T(std::move(tmp));
+    std::swap(packed_[a], packed_[b]);
+    sparse_[packed_[a]] = std::uint32_t(a);
+    sparse_[packed_[b]] = std::uint32_t(b);
+  }
+
+ private:
+  void grow() {
+    std::size_t storage = std::max<std::size_t>(storage_ * 2, 64);
+    T *data = static_cast<T*>(::operator new(storage * sizeof(T)));
+    for (std::size_t i = 0; i < packed_.size(); i++) {
+      new(data + i) T(std::move(data_[i]));
+      data_[i].~T();
+    }
+    ::operator delete(data_);
+    data_ = data;
+    storage_ = storage;
+  }
+
+  T *data_ = nullptr;
+  std::size_t storage_ = 0;
+};
+
+
+/**
+ * Storage for flags: empty components that are additionally tracked in a dense
+ * bitset, one bit per element, so that they can be tested, counted and
+ * iterated 64 elements at a time.
+ *
+ * Flags have no per-element data, so get() must not be used.
+ */
+class FlagPool : public BasePool {
+ public:
+  FlagPool() : BasePool(0, 64) {}
+
+  inline bool test(std::size_t n) const {
+    assert(n < size_);
+    return words_[n / 64] & (std::uint64_t(1) << (n % 64));
   }
+
+  inline void set(std::size_t n) {
+    assert(n < size_);
+    words_[n / 64] |= std::uint64_t(1) << (n % 64);
+  }
+
+  inline void reset(std::size_t n) {
+    assert(n < size_);
+    words_[n / 64] &= ~(std::uint64_t(1) << (n % 64));
+  }
+
+  /// Bits for elements [64 * i, 64 * i + 64).
+  inline std::uint64_t word(std::size_t i) const { return words_[i]; }
+  std::size_t words() const { return words_.size(); }
+
+  virtual void reserve(std::size_t n) override {
+    if (n > capacity_) {
+      words_.resize((n + 63) / 64, 0);
+      capacity_ = words_.size() * 64;
+    }
+  }
+
+  virtual void resize(std::size_t n) override {
+    this->expand(n);
+  }
+
+  virtual void destroy(std::size_t n) override { reset(n); }
+
+  virtual void relocate(const std::vector<std::uint32_t> &from, const std::vector<std::uint32_t> &to) override {
+    assert(from.size() == to.size());
+    std::vector<bool> bits(from.size());
+    for (std::size_t k = 0; k < from.size(); k++) {
+      bits[k] = test(from[k]);
+      reset(from[k]);
+    }
+    for (std::size_t k = 0; k < to.size(); k++) {
+      if (bits[k]) set(to[k]);
+    }
+  }
+
+  static inline std::size_t popcount(std::uint64_t word) {
+#if defined(_MSC_VER)
+    return __popcnt64(word);
+#else
+    return __builtin_popcountll(word);
+#endif
+  }
+
+  /// Index of the lowest set bit. word must be non-zero.
+  static inline std::size_t lowest_bit(std::uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return __builtin_ctzll(word);
+#endif
+  }
+
+ private:
+  std::vector<std::uint64_t> words_;
+};
+
+
+/**
+ * Modification ticks of the elements of a pool, plus the latest tick within
+ * each run of CHUNK_SIZE elements, so that unchanged runs can be skipped.
+ *
+ * Ticks must be marked in increasing order.
+ */
+class ChangeTicks {
+ public:
+  static constexpr std::size_t CHUNK_SIZE = 64;
+
+  void resize(std::size_t n) {
+    if (n > ticks_.size()) {
+      ticks_.resize(n, 0);
+      chunks_.resize((n + CHUNK_SIZE - 1) / CHUNK_SIZE, 0);
+    }
+  }
+
+  inline void mark(std::size_t n, std::uint64_t tick) {
+    ticks_[n] = tick;
+    chunks_[n / CHUNK_SIZE] = tick;
+  }
+
+  inline std::uint64_t tick(std::size_t n) const { return ticks_[n]; }
+
+  /// Latest tick of elements [CHUNK_SIZE * i, CHUNK_SIZE * i + CHUNK_SIZE).
+  inline std::uint64_t chunk_tick(std::size_t i) const { return chunks_[i]; }
+
+  /// Move the tick of each element from[k] to to[k], in one pass.
+  void relocate(const std::vector<std::uint32_t> &from, const std::vector<std::uint32_t> &to) {
+    std::vector<std::uint64_t> ticks(from.size());
+    for (std::size_t k = 0; k < from.size(); k++) ticks[k] = ticks_[from[k]];
+    for (std::size_t k = 0; k < to.size(); k++) {
+      ticks_[to[k]] = ticks[k];
+      chunks_[to[k] / CHUNK_SIZE] = std::max(chunks_[to[k] / CHUNK_SIZE], ticks[k]);
+    }
+  }
+
+ private:
+  std::vector<std::uint64_t> ticks_;
+  std::vector<std::uint64_t> chunks_;
+};
+
+
+/**
+ * Selects the pool used to store components of type C.
+ *
+ * Specialise this to choose a different storage strategy for a component:
+ *
+ *     namespace entityx {
+ *     template <> struct PoolTraits<Position> { typedef ContiguousPool<Position> PoolType; };
+ *     template <> struct PoolTraits<Inventory> { typedef Pool<Inventory, 16> PoolType; };
+ *     }
+ *
+ * - Pool (the default) allocates fixed size chunks. Pointers to a component
+ *   remain valid until the component is removed. Chunks hold 8192 elements
+ *   unless ENTITYX_POOL_CHUNK_BYTES is configured, in which case the chunk
+ *   size of each component is derived from that byte size.
+ * - ContiguousPool keeps all components in one buffer for maximum streaming
+ *   bandwidth. ComponentHandles remain valid, but raw pointers obtained from
+ *   them are invalidated whenever the pool grows, ie. when new entity slots
+ *   are allocated.
+ * - PackedPool keeps components densely packed in one buffer, so that
+ *   groups can own them (see EntityManager::owning_group()). Raw pointers
+ *   obtained from ComponentHandles are invalidated whenever a component of
+ *   the same type is assigned or removed.
+ * - FlagPool turns an empty component into a flag, additionally tracked in a
+ *   dense bitset (see EntityManager::set_flag() and entities_with_flags()).
+ *
+ * Empty components are otherwise stored purely as component mask bits, and
+ * their PoolType is ignored.
+ */
+template <typename C>
+struct PoolTraits {
+  typedef Pool<C, POOL_CHUNK_BYTES ? ChunkSizeFor<C, POOL_CHUNK_BYTES>::value : 8192> PoolType;
 };
 
 }  // namespace entityx
@@ -78,3 +78,105 @@ TEST_CASE("TestDeconstruct") {
   pool.destroy(0);
   REQUIRE(2 ==  counter);
 }
+
+struct Velocity {
+  float x, y;
+};
+
+TEST_CASE("TestContiguousPoolIsContiguous") {
+  entityx::ContiguousPool<Velocity> pool;
+  REQUIRE(0 == pool.capacity());
+  pool.expand(10);
+  REQUIRE(1 == pool.chunks());
+  static_cast<Velocity*>(pool.get(9))->x = 9;
+  pool.expand(1000);
+  REQUIRE(1000 <= pool.capacity());
+  REQUIRE(1 == pool.chunks());
+  Velocity *p0 = static_cast<Velocity*>(pool.get(0));
+  for (std::size_t i = 0; i < 1000; i++) {
+    REQUIRE(static_cast<void*>(p0 + i) == pool.get(i));
+    REQUIRE(pool.get(i) == static_cast<entityx::BasePool&>(pool).get(i));
+  }
+  REQUIRE(9 == static_cast<Velocity*>(pool.get(9))->x);
+}
+
+TEST_CASE("TestChunkSizeFor") {
+  struct Large { char data[2048]; };
+  REQUIRE(16384 == (entityx::ChunkSizeFor<int, 65536>::value));
+  REQUIRE(4096 == (entityx::ChunkSizeFor<Position, 65536>::value));
+  REQUIRE(32 == (entityx::ChunkSizeFor<Large, 65536>::value));
+  REQUIRE(1 == (entityx::ChunkSizeFor<Large, 1024>::value));
+
+  entityx::Pool<Large, entityx::ChunkSizeFor<Large, 65536>::value> pool;
+  pool.expand(100);
+  REQUIRE(4 == pool.chunks());
+  REQUIRE(pool.get(33) == static_cast<entityx::BasePool&>(pool).get(33));
+}
+
+TEST_CASE("TestPoolResizeAllocatesLazily") {
+  entityx::Pool<Position, 8> pool;
+  pool.resize(64);
+  REQUIRE(64 == pool.size());
+  REQUIRE(64 == pool.capacity());
+  REQUIRE(8 == pool.chunks());
+  REQUIRE(0 == pool.allocated_chunks());
+
+  int counter = 0;
+  new(pool.allocate(42)) Position(&counter);
+  REQUIRE(1 == pool.allocated_chunks());
+  REQUIRE(pool.allocate(42) == pool.get(42));
+  pool.relocate({42}, {3});
+  REQUIRE(2 == pool.allocated_chunks());
+  REQUIRE(&counter == static_cast<Position*>(pool.get(3))->ptr);
+  pool.destroy(3);
+  // The moved-from source and the relocation buffer are destroyed too.
+  REQUIRE(4 == counter);
+
+  pool.reserve(64);
+  REQUIRE(8 == pool.allocated_chunks());
+}
+
+TEST_CASE("TestPackedPool") {
+  struct Velocity { float x, y; };
+  entityx::PackedPool<Velocity> pool;
+  pool.resize(100);
+  for (int i = 99; i >= 0; i -= 10) new(pool.allocate(i)) Velocity{static_cast<float>(i), 0};
+  REQUIRE(10 == pool.count());
+  REQUIRE(0 == pool.position(99));
+  REQUIRE(99 == pool.element(0));
+  REQUIRE(9 == static_cast<Velocity*>(pool.get(9))->x);
+
+  // Destroying an element packs the last one into its place.
+  pool.destroy(99);
+  REQUIRE(9 == pool.count());
+  REQUIRE(9 == pool.element(0));
+  REQUIRE(9 == pool.data()[0].x);
+
+  pool.swap_positions(0, 8);
+  REQUIRE(8 == pool.position(9));
+  REQUIRE(9 == pool.data()[8].x);
+  REQUIRE(9 == static_cast<Velocity*>(pool.get(9))->x);
+
+  // Relocating only relabels elements.
+  pool.relocate({9}, {98});
+  REQUIRE(8 == pool.position(98));
+  REQUIRE(9 == static_cast<Velocity*>(pool.get(98))->x);
+}
+
+TEST_CASE("TestPoolRelocate") {
+  entityx::Pool<int, 4> pool;
+  pool.expand(10);
+  for (int i = 0; i < 3; i++) new(pool.allocate(i)) int(i);
+  // A cycle, and a move into an empty slot.
+  pool.relocate({0, 1, 2}, {1, 2, 9});
+  REQUIRE(0 == *static_cast<int*>(pool.get(1)));
+  REQUIRE(1 == *static_cast<int*>(pool.get(2)));
+  REQUIRE(2 == *static_cast<int*>(pool.get(9)));
+
+  entityx::FlagPool flags;
+  flags.expand(4);
+  flags.set(0);
+  flags.relocate({0, 1}, {1, 0});
+  REQUIRE(!flags.test(0));
+  REQUIRE(flags.test(1));
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2012-2014 Alec Thomas <alec@swapoff.org>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: Alec Thomas <alec@swapoff.org>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace entityx {
+namespace help {
+
+/**
+ * A vector that stores up to N elements inline, only allocating once it
+ * grows beyond that.
+ *
+ * Only the operations needed by EntityX are provided. Erasure moves the last
+ * element into the hole, so element order is not preserved.
+ */
+template <typename T, std::size_t N>
+class SmallVector {
+  static_assert(N > 0, "SmallVector requires inline capacity");
+
+ public:
+  SmallVector() : data_(inline_data()) {}
+  SmallVector(const SmallVector &) = delete;
+  SmallVector &operator = (const SmallVector &) = delete;
+
+  SmallVector(SmallVector &&other) : data_(inline_data()) { take(other); }
+
+  SmallVector &operator = (SmallVector &&other) {
+    if (this == &other) return *this;
+    clear();
+    if (data_ != inline_data()) ::operator delete(data_);
+    data_ = inline_data();
+    capacity_ = N;
+    take(other);
+    return *this;
+  }
+
+  ~SmallVector() {
+    clear();
+    if (data_ != inline_data()) ::operator delete(data_);
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  std::size_t capacity() const { return capacity_; }
+  /// True if the elements are stored inline.
+  bool is_inline() const { return data_ == inline_data(); }
+
+  T &operator [] (std::size_t i) { return data_[i]; }
+  const T &operator [] (std::size_t i) const { return data_[i]; }
+
+  T *begin() { return data_; }
+  T *end() { return data_ + size_; }
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+
+  void push_back(T value) {
+    if (size_ == capacity_) grow(capacity_ * 2);
+    new(data_ + size_) T(std::move(value));
+    size_++;
+  }
+
+  /// Remove element i, replacing it with the last element.
+  void swap_erase(std::size_t i) {
+    if (i != size_ - 1) data_[i] = std::move(data_[size_ - 1]);
+    data_[--size_].~T();
+  }
+
+  void clear() {
+    for (std::size_t i = 0; i < size_; i++) data_[i].~T();
+    size_ = 0;
+  }
+
+ private:
+  // Move the elements of other into this empty, inline vector, leaving other
+  // empty. Heap storage is taken over rather than moved element by element.
+  void take(SmallVector &other) {
+    if (other.is_inline()) {
+      for (std::size_t i = 0; i < other.size_; i++) new(data_ + i) T(std::move(other.data_[i]));
+      size_ = other.size_;
+      other.clear();
+    } else {
+      data_ = other.data_;
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.data_ = other.inline_data();
+      other.size_ = 0;
+      other.capacity_ = N;
+    }
+  }
+
+  T *inline_data() { return reinterpret_cast<T*>(&storage_); }
+  const T *inline_data() const { return reinterpret_cast<const T*>(&storage_); }
+
+  void grow(std::size_t capacity) {
+    T *data = static_cast<T*>(::operator new(sizeof(T) * capacity));
+    for (std::size_t i = 0; i < size_; i++) {
+      new(data + i) T(std::move(data_[i]));
+      data_[i].~T();
+    }
+    if (data_ != inline_data()) ::operator delete(data_);
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type storage_;
+  T *data_;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = N;
+};
+
+}  // namespace help
+}  // namespace entityx